@@ -0,0 +1,158 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+// Logger 的后台输出：各线程把格式化好的记录放入无锁的有界环形队列
+// (Vyukov 的 MPMC 队列，这里只有一个消费者)，由一个后台线程写到 stdout 或文件。
+// 队列满时生产者让出 CPU 等待，不丢记录。队列为空时后台线程在条件变量上休眠，
+// 生产者只在它休眠时才加锁唤醒。进程正常退出 (包括 exit) 时析构函数会写完
+// 剩余的记录；Flush 阻塞到调用前放入的记录都已写出
+class AsyncLog {
+ public:
+  constexpr static size_t kCapacity = 1024;
+  constexpr static size_t kMaxText = 500;
+
+  struct Record {
+    FILE *file;
+    bool to_screen;
+    unsigned short size;
+    char text[kMaxText];
+  };
+
+  static AsyncLog &Instance() {
+    static AsyncLog log;
+    return log;
+  }
+
+  // 写入一条已经格式化的记录，text 超过 kMaxText 时被截断
+  template <typename F>
+  void Push(bool to_screen, FILE *file, F &&format) {
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells[pos & (kCapacity - 1)];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = intptr_t(seq) - intptr_t(pos);
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        // 队列已满
+        std::this_thread::yield();
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    auto &record = cell->record;
+    record.file = file;
+    record.to_screen = to_screen;
+    record.size = format(record.text, kMaxText);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    // 与 WaitForRecord 中的 fence 配对：要么这里看到 sleeping，要么写线程看到这条记录
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(wake_mutex);
+      wake.notify_one();
+    }
+  }
+
+  // 信号处理函数中调用时应给出 timeout：被打断的线程可能正写到一半，它的记录永远不会完成
+  bool Flush(std::chrono::milliseconds timeout = std::chrono::milliseconds::max()) {
+    size_t target = enqueue_pos.load(std::memory_order_acquire);
+    auto deadline = std::chrono::steady_clock::now()
+      + std::min(timeout, std::chrono::milliseconds(std::chrono::hours(24 * 365)));
+    while (written.load(std::memory_order_acquire) < target) {
+      if (std::chrono::steady_clock::now() >= deadline) return false;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return true;
+  }
+
+  ~AsyncLog() {
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex);
+      stopping.store(true, std::memory_order_release);
+    }
+    wake.notify_one();
+    writer.join();
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    Record record;
+  };
+
+  AsyncLog() {
+    for (size_t i = 0; i < kCapacity; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+    writer = std::thread([this]() { WriterLoop(); });
+  }
+
+  AsyncLog(const AsyncLog&) = delete;
+  AsyncLog &operator=(const AsyncLog&) = delete;
+
+  bool HasRecord() const {
+    auto &cell = cells[dequeue_pos & (kCapacity - 1)];
+    return cell.sequence.load(std::memory_order_acquire) == dequeue_pos + 1;
+  }
+
+  // 取出一条记录写出，队列为空时返回 false
+  bool WriteOne() {
+    if (!HasRecord()) return false;
+    auto &cell = cells[dequeue_pos & (kCapacity - 1)];
+    auto &record = cell.record;
+    if (record.to_screen) fwrite(record.text, 1, record.size, stdout);
+    if (record.file) fwrite(record.text, 1, record.size, record.file);
+    cell.sequence.store(dequeue_pos + kCapacity, std::memory_order_release);
+    ++dequeue_pos;
+    return true;
+  }
+
+  void WriterLoop() {
+    while (true) {
+      // 先读 stopping 再清空队列：停止后的最后一轮一定会写完之前放入的记录
+      bool stop = stopping.load(std::memory_order_acquire);
+      bool any = false;
+      while (WriteOne()) any = true;
+      if (any) {
+        fflush(nullptr);
+        written.store(dequeue_pos, std::memory_order_release);
+      } else if (stop) {
+        break;
+      } else {
+        WaitForRecord();
+      }
+    }
+  }
+
+  // 队列为空时休眠，直到有新记录或者开始停止
+  void WaitForRecord() {
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wake.wait(lock, [this]() {
+      return HasRecord() || stopping.load(std::memory_order_acquire);
+    });
+    sleeping.store(false, std::memory_order_relaxed);
+  }
+
+  Cell cells[kCapacity];
+  alignas(64) std::atomic<size_t> enqueue_pos{0};
+  alignas(64) size_t dequeue_pos = 0;
+  std::atomic<size_t> written{0};
+  std::atomic<bool> stopping{false};
+  std::atomic<bool> sleeping{false};
+  std::mutex wake_mutex;
+  std::condition_variable wake;
+  std::thread writer;
+};
+
+#endif
@@ -0,0 +1,260 @@
+// 基准测试，用 `make bench` 构建并运行：
+//   bench.out run bench.json [-compare baseline.json] [-tolerance 0.1] [-data bench-data.txt]
+//     [-rows 100000] [-features 201] [-density 0.15] [-seed 1] [-repeat 5]
+//     [-c 10] [-sample-size 10000] [-d 10] [-split exact|hist] [-p 0]
+//     [-criterion gini|entropy|misclass]
+//   bench.out gen data.txt [-rows ...] [-features ...] [-density ...] [-seed ...]
+//   bench.out compare bench.json -baseline baseline.json [-tolerance 0.1]
+// run 先按参数生成合成数据，再依次测量解析、单特征分裂搜索 (排序与 SparseColumns 两种)、
+// 单棵树、整个森林和打分 (默认内核及各遍历内核分别计时)，结果写为 JSON；
+// 给出 baseline 时中位数变慢超过 tolerance 的项记为退化，退出码为 1
+#include "random-forest.h"
+#include "data-reader.h"
+#include "synthetic-data.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+struct BenchResult {
+  std::string name;
+  // 每次运行处理的量，per_s = items / median_s
+  std::string unit;
+  double items = 0.0;
+  double median_s = 0.0;
+  double min_s = 0.0;
+};
+
+template <typename F>
+BenchResult Measure(const std::string &name, const std::string &unit, double items, int repeat,
+  F &&func) {
+  std::vector<double> seconds;
+  for (int i = 0; i < std::max(repeat, 1); ++i) {
+    auto start = high_clock::now();
+    func();
+    seconds.push_back(duration_cast<duration<double>>(high_clock::now() - start).count());
+  }
+  std::sort(seconds.begin(), seconds.end());
+  BenchResult res = { name, unit, items, seconds[seconds.size() / 2], seconds.front() };
+  printf("%-20s median %10.6lf s  min %10.6lf s  %14.1lf %s/s\n", name.c_str(), res.median_s,
+    res.min_s, items / res.median_s, unit.c_str());
+  return res;
+}
+
+// 每个结果占一行，便于 ReadResults 逐行读回
+void WriteResults(const std::string &filename, const std::string &config,
+  const std::vector<BenchResult> &results) {
+  std::ofstream ofs(filename);
+  if (!ofs.is_open()) {
+    throw std::string("File not opened: ") + filename;
+  }
+  ofs << "{\n  \"config\": {" << config << "},\n  \"results\": [\n";
+  char line[512];
+  for (int i = 0; i < results.size(); ++i) {
+    auto &r = results[i];
+    snprintf(line, sizeof(line),
+      "    {\"name\": \"%s\", \"unit\": \"%s\", \"items\": %.17g, \"median_s\": %.9g, "
+      "\"min_s\": %.9g, \"per_s\": %.9g}%s\n", r.name.c_str(), r.unit.c_str(), r.items,
+      r.median_s, r.min_s, r.items / r.median_s, i + 1 < results.size() ? "," : "");
+    ofs << line;
+  }
+  ofs << "  ]\n}\n";
+}
+
+// 只读取 WriteResults 写出的格式
+std::vector<BenchResult> ReadResults(const std::string &filename) {
+  std::ifstream ifs(filename);
+  if (!ifs.is_open()) {
+    throw std::string("File not opened: ") + filename;
+  }
+  std::vector<BenchResult> results;
+  std::string line;
+  while (std::getline(ifs, line)) {
+    char name[128], unit[64];
+    BenchResult r;
+    if (sscanf(line.c_str(),
+      " {\"name\": \"%127[^\"]\", \"unit\": \"%63[^\"]\", \"items\": %lf, \"median_s\": %lf, "
+      "\"min_s\": %lf", name, unit, &r.items, &r.median_s, &r.min_s) == 5) {
+      r.name = name;
+      r.unit = unit;
+      results.push_back(r);
+    }
+  }
+  return results;
+}
+
+// 返回退化的项数。按每单位的耗时比较，因此改变数据规模后仍大致可比
+int Compare(const std::vector<BenchResult> &results, const std::vector<BenchResult> &baseline,
+  double tolerance) {
+  int regressions = 0;
+  printf("\n%-20s %14s %14s %9s\n", "benchmark", "baseline/s", "current/s", "change");
+  for (auto &r : results) {
+    auto base = std::find_if(baseline.begin(), baseline.end(), [&r](const BenchResult &b) {
+      return b.name == r.name;
+    });
+    if (base == baseline.end()) {
+      printf("%-20s %14s %14.1lf %9s\n", r.name.c_str(), "-", r.items / r.median_s, "new");
+      continue;
+    }
+    double base_per_s = base->items / base->median_s;
+    double per_s = r.items / r.median_s;
+    double change = per_s / base_per_s - 1.0;
+    bool regressed = per_s < base_per_s / (1.0 + tolerance);
+    if (regressed) ++regressions;
+    printf("%-20s %14.1lf %14.1lf %+8.1lf%%%s\n", r.name.c_str(), base_per_s, per_s,
+      change * 100.0, regressed ? "  REGRESSION" : "");
+  }
+  return regressions;
+}
+
+void ShowHint() {
+  printf("Use bench run bench.json [-compare baseline.json] [-tolerance 0.1] ...\n");
+  printf("    bench gen data.txt [-rows 100000] [-features 201] [-density 0.15] [-seed 1]\n");
+  printf("    bench compare bench.json -baseline baseline.json [-tolerance 0.1]\n");
+}
+
+int Run(int argc, char *args[]) {
+  if (argc <= 2) {
+    ShowHint();
+    return 1;
+  }
+  std::string arg1 = args[1];
+  std::string arg2 = args[2];
+  ArgsTable table = ParseArgs(argc, args, 3);
+
+  int rows_count = 100000;
+  int features_count = 201;
+  double density = 0.15;
+  int seed = 1;
+  TableValToInt(table, "-rows", rows_count);
+  TableValToInt(table, "-features", features_count);
+  TableValToDouble(table, "-density", density);
+  TableValToInt(table, "-seed", seed);
+  double tolerance = 0.1;
+  TableValToDouble(table, "-tolerance", tolerance);
+
+  if (arg1 == "gen") {
+    int ones_count = SyntheticData::Write(arg2, rows_count, features_count, density, seed);
+    printf("%d of %d rows labelled 1\n", ones_count, rows_count);
+    return 0;
+  }
+  if (arg1 == "compare") {
+    std::string baseline;
+    TableValToString(table, "-baseline", baseline);
+    return Compare(ReadResults(arg2), ReadResults(baseline), tolerance) > 0;
+  }
+  if (arg1 != "run") {
+    ShowHint();
+    return 1;
+  }
+
+  int repeat = 5;
+  int tree_count = 10;
+  int one_sample_size = 10000;
+  int max_depth = 10;
+  int threading = 0;
+  std::string split = "exact";
+  std::string criterion = "gini";
+  std::string data = "bench-data.txt";
+  std::string baseline;
+  TableValToInt(table, "-repeat", repeat);
+  TableValToInt(table, "-c", tree_count);
+  TableValToInt(table, "-sample-size", one_sample_size);
+  TableValToInt(table, "-d", max_depth);
+  TableValToInt(table, "-p", threading);
+  TableValToString(table, "-split", split);
+  TableValToString(table, "-criterion", criterion);
+  TableValToString(table, "-data", data);
+  TableValToString(table, "-compare", baseline);
+  one_sample_size = std::min(one_sample_size, rows_count);
+
+  char config[512];
+  snprintf(config, sizeof(config),
+    "\"rows\": %d, \"features\": %d, \"density\": %g, \"seed\": %d, \"repeat\": %d, "
+    "\"trees\": %d, \"sample_size\": %d, \"max_depth\": %d, \"split\": \"%s\", \"threads\": %d, "
+    "\"criterion\": \"%s\"",
+    rows_count, features_count, density, seed, repeat, tree_count, one_sample_size, max_depth,
+    split.c_str(), threading, criterion.c_str());
+  printf("Generating %s: %d rows, %d features, density %g\n", data.c_str(), rows_count,
+    features_count, density);
+  int ones_count = SyntheticData::Write(data, rows_count, features_count, density, seed);
+  printf("%d of %d rows labelled 1\n", ones_count, rows_count);
+
+  std::vector<BenchResult> results;
+  FeatureMatrix matrix;
+  {
+    MappedFile file(data);
+    ThreadPool pool(ThreadCount(threading));
+    results.push_back(Measure("parse", "MB", file.Size() / 1e6, repeat, [&]() {
+      LibsvmParser::Parse(file.Data(), file.Size(), features_count, pool, matrix);
+    }));
+  }
+  if (split == "hist") matrix.BuildBins();
+
+  DecisionTreeInfo info;
+  info.max_depth = max_depth;
+  info.split_mode = split == "hist" ? DecisionTree::SplitMode::kHist
+                                    : DecisionTree::SplitMode::kExact;
+  info.criterion = ParseSplitCriterion(criterion);
+  RandomForest rf(features_count, matrix, threading, info, tree_count, one_sample_size,
+    Logger(false));
+  rf.seed = seed;
+
+  {
+    // 在 one_sample_size 个样本上对前 kBenchFeatures 个特征逐一搜索最优分裂
+    constexpr int kBenchFeatures = 16;
+    DecisionTree tree;
+    tree.FromInfo(rf.decision_tree_info);
+    tree.matrix = &matrix;
+    tree.indexes = Randomer(seed).Sample(matrix.rows_count, one_sample_size);
+    int features = std::min(kBenchFeatures, features_count);
+    results.push_back(Measure("best_split_feature", "features", features, repeat, [&]() {
+      for (int f = 0; f < features; ++f) {
+        tree.GetBestSplit<GiniCriterion>(0, tree.indexes.size(), { f });
+      }
+    }));
+    // 同样的搜索在 SparseColumns 上进行 (exact 模式建树时的做法)，不含建列的时间
+    auto columns = tree.BuildSparseColumns();
+    results.push_back(Measure("best_split_sparse", "features", features, repeat, [&]() {
+      for (int f = 0; f < features; ++f) {
+        tree.GetBestSplit<GiniCriterion>(0, tree.indexes.size(), { f }, &columns);
+      }
+    }));
+  }
+  results.push_back(Measure("tree_build", "trees", 1, repeat, [&]() {
+    rf.CalcOneTree(0);
+  }));
+  results.push_back(Measure("calc_trees", "trees", tree_count, repeat, [&]() {
+    rf.trees.clear();
+    rf.CalcTrees();
+  }));
+  results.push_back(Measure("test", "samples", matrix.rows_count, repeat, [&]() {
+    rf.Test();
+  }));
+  // 各遍历内核分别计时，当前 CPU 不支持的内核没有对应的项
+  auto default_kernel = rf.kernel;
+  for (auto kernel : { TraversalKernel::kScalar, TraversalKernel::kAvx2,
+    TraversalKernel::kAvx512 }) {
+    if (!TraversalKernelSupported(kernel)) continue;
+    rf.kernel = kernel;
+    results.push_back(Measure(std::string("test_") + TraversalKernelName(kernel), "samples",
+      matrix.rows_count, repeat, [&]() {
+        rf.Test();
+      }));
+  }
+  rf.kernel = default_kernel;
+
+  WriteResults(arg2, config, results);
+  printf("Results written to %s\n", arg2.c_str());
+  if (!baseline.empty()) {
+    return Compare(results, ReadResults(baseline), tolerance) > 0;
+  }
+  return 0;
+}
+
+int main(int argc, char *args[]) {
+  return RunMain(argc, args, Run);
+}
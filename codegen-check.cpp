@@ -0,0 +1,69 @@
+// 用 `make codegen-check` 构建：比较 export-cpp 生成的代码与解释执行的 RandomForest::Test
+// 在同一份数据上的投票结果，并输出两者的耗时。结果不一致时返回非 0
+#include "random-forest.h"
+#include "data-reader.h"
+#include "rf-model-gen.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+int Run(int argc, char *args[]) {
+  if (argc < 3) {
+    printf("Use codegen-check test_data tree.bin\n");
+    return 1;
+  }
+  static_assert(rf_model::kFeaturesCount > 0, "empty model");
+  Logger logger(1, false);
+  DataReader reader(args[1], rf_model::kFeaturesCount);
+  auto &matrix = reader.matrix;
+
+  RandomForest rf(rf_model::kFeaturesCount, matrix, 0, DecisionTreeInfo(), 100, 1000, logger);
+  rf.LoadTreesFromFile(args[2]);
+  if (rf.trees.size() != rf_model::kTreeCount) {
+    printf("%s has %lu trees but the generated code has %d, regenerate it\n", args[2],
+      rf.trees.size(), rf_model::kTreeCount);
+    return 1;
+  }
+  rf.Test();
+
+  // 生成的代码按行读取特征，先转成行优先存放，不计入耗时
+  std::vector<double> rows(size_t(matrix.rows_count) * matrix.features_count);
+  for (int f = 0; f < matrix.features_count; ++f) {
+    auto column = matrix.Column(f);
+    for (int i = 0; i < matrix.rows_count; ++i) {
+      rows[size_t(i) * matrix.features_count + f] = column[i];
+    }
+  }
+  std::vector<std::pair<int, int>> votes(matrix.rows_count);
+  auto start = high_clock::now();
+  for (int i = 0; i < matrix.rows_count; ++i) {
+    int v[2] = { 0, 0 };
+    rf_model::Vote(rows.data() + size_t(i) * matrix.features_count, v);
+    votes[i] = { v[0], v[1] };
+  }
+  double seconds = duration_cast<duration<double>>(high_clock::now() - start).count();
+  logger.Info("Generated code: %d samples in %lf s (%.0lf samples/s)", matrix.rows_count,
+    seconds, matrix.rows_count / seconds);
+
+  int mismatch_count = 0;
+  for (int i = 0; i < matrix.rows_count; ++i) {
+    if (votes[i] != rf.decision_res[i]) {
+      if (mismatch_count < 10) {
+        printf("Row %d: generated (%d, %d), interpreted (%d, %d)\n", i, votes[i].first,
+          votes[i].second, rf.decision_res[i].first, rf.decision_res[i].second);
+      }
+      ++mismatch_count;
+    }
+  }
+  if (mismatch_count > 0) {
+    printf("%d of %d rows differ\n", mismatch_count, matrix.rows_count);
+    return 1;
+  }
+  printf("All %d rows match\n", matrix.rows_count);
+  return 0;
+}
+
+int main(int argc, char *args[]) {
+  return RunMain(argc, args, Run);
+}
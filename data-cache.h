@@ -0,0 +1,146 @@
+#ifndef DATA_CACHE_H
+#define DATA_CACHE_H
+
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <sys/stat.h>
+#include "feature-matrix.h"
+#include "mapped-file.h"
+#include "profiler.h"
+#include "util.h"
+
+// 文本数据集解析一次后的二进制缓存，存放在 <数据文件>.cache：
+//   DataCacheHeader
+//   (补齐到 kDataCacheAlign)  values: FeatureVal * rows_count * features_count (column-major)
+//   labels: LabelType * rows_count
+// 源文件的大小、修改时间或抽样内容的 hash 变化时缓存失效并重新生成。
+// 加载时不复制数据，FeatureMatrix 直接读映射的页，多个进程共享同一份页缓存
+constexpr char kDataCacheMagic[8] = { 'R', 'F', 'D', 'A', 'T', 'A', '\0', '\0' };
+constexpr uint32_t kDataCacheVersion = 1;
+constexpr size_t kDataCacheAlign = 64;
+
+struct DataCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t value_size;
+  int32_t rows_count;
+  int32_t features_count;
+  uint64_t source_size;
+  int64_t source_mtime_ns;
+  uint64_t source_hash;
+  uint64_t values_offset;
+  uint64_t labels_offset;
+};
+
+struct SourceFingerprint {
+  uint64_t size = 0;
+  int64_t mtime_ns = 0;
+  uint64_t hash = 0;
+
+  bool operator==(const SourceFingerprint &rhs) const {
+    return size == rhs.size && mtime_ns == rhs.mtime_ns && hash == rhs.hash;
+  }
+};
+
+struct DataCache {
+  // 只对文件首、中、尾各 kHashSampleSize 字节做 hash，保证指纹的代价与文件大小无关
+  constexpr static size_t kHashSampleSize = 64 << 10;
+
+  static std::string CacheFilename(const std::string &filename) {
+    return filename + ".cache";
+  }
+
+  static SourceFingerprint Fingerprint(const std::string &filename, const MappedFile &file) {
+    SourceFingerprint fingerprint;
+    struct stat st;
+    if (stat(filename.c_str(), &st) == 0) {
+      fingerprint.mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    }
+    auto size = file.Size();
+    fingerprint.size = size;
+    auto sample = std::min(size, kHashSampleSize);
+    uint64_t hash = Fnv1a(file.Data(), sample);
+    if (size > sample) {
+      hash = Fnv1a(file.Data() + (size - sample) / 2, sample, hash);
+      hash = Fnv1a(file.Data() + size - sample, sample, hash);
+    }
+    fingerprint.hash = hash;
+    return fingerprint;
+  }
+
+  // 缓存不存在、已失效或格式不符时返回 false
+  static bool Load(const std::string &cache_filename, const SourceFingerprint &fingerprint,
+    int features_count, FeatureMatrix &matrix) {
+    PROFILE_SCOPE("LoadCache");
+    std::shared_ptr<MappedFile> file;
+    try {
+      file = std::make_shared<MappedFile>(cache_filename);
+    } catch (const std::string &) {
+      return false;
+    }
+    DataCacheHeader header;
+    if (file->Size() < sizeof(header)) return false;
+    memcpy(&header, file->Data(), sizeof(header));
+    SourceFingerprint cached = { header.source_size, header.source_mtime_ns, header.source_hash };
+    size_t values_size = sizeof(FeatureVal) * size_t(header.rows_count) * header.features_count;
+    if (memcmp(header.magic, kDataCacheMagic, sizeof(kDataCacheMagic)) != 0
+      || header.version != kDataCacheVersion
+      || header.value_size != sizeof(FeatureVal)
+      || header.features_count != features_count
+      || !(cached == fingerprint)
+      || header.values_offset % alignof(FeatureVal) != 0
+      || header.labels_offset != header.values_offset + values_size
+      || header.labels_offset + header.rows_count > file->Size()) {
+      return false;
+    }
+    matrix = FeatureMatrix();
+    matrix.rows_count = header.rows_count;
+    matrix.features_count = header.features_count;
+    matrix.mapped_values = reinterpret_cast<const FeatureVal*>(file->Data() + header.values_offset);
+    matrix.mapped_labels = reinterpret_cast<const LabelType*>(file->Data() + header.labels_offset);
+    matrix.mapped_file = std::move(file);
+    PROFILE_COUNT(kBytesRead, header.labels_offset + header.rows_count);
+    return true;
+  }
+
+  // 先写临时文件再 rename，中途失败不会留下半个缓存
+  static bool Save(const std::string &cache_filename, const SourceFingerprint &fingerprint,
+    const FeatureMatrix &matrix) {
+    PROFILE_SCOPE("SaveCache");
+    DataCacheHeader header = {};
+    memcpy(header.magic, kDataCacheMagic, sizeof(kDataCacheMagic));
+    header.version = kDataCacheVersion;
+    header.value_size = sizeof(FeatureVal);
+    header.rows_count = matrix.rows_count;
+    header.features_count = matrix.features_count;
+    header.source_size = fingerprint.size;
+    header.source_mtime_ns = fingerprint.mtime_ns;
+    header.source_hash = fingerprint.hash;
+    header.values_offset = AlignUp(sizeof(header), kDataCacheAlign);
+    size_t values_count = size_t(matrix.rows_count) * matrix.features_count;
+    header.labels_offset = header.values_offset + sizeof(FeatureVal) * values_count;
+    std::vector<char> padding(header.values_offset - sizeof(header), 0);
+
+    auto tmp_filename = cache_filename + ".tmp";
+    {
+      std::ofstream ofs(tmp_filename, std::ios_base::binary);
+      if (!ofs.is_open()) return false;
+      ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      ofs.write(padding.data(), padding.size());
+      ofs.write(reinterpret_cast<const char*>(matrix.Values()), sizeof(FeatureVal) * values_count);
+      ofs.write(matrix.Labels(), matrix.rows_count);
+      if (!ofs) {
+        std::remove(tmp_filename.c_str());
+        return false;
+      }
+    }
+    return std::rename(tmp_filename.c_str(), cache_filename.c_str()) == 0;
+  }
+};
+
+#endif
@@ -1,46 +1,223 @@
 #ifndef DATA_READER_H
 #define DATA_READER_H
 
-#include <fstream>
 #include <memory>
-#include "sample.h"
+#include <vector>
+#include <string>
+#include <charconv>
+#include <cstring>
+#include <thread>
+#include "feature-matrix.h"
+#include "mapped-file.h"
+#include "data-cache.h"
+#include "thread-pool.h"
+#include "profiler.h"
 #include "util.h"
 
-struct DataReader {
-  constexpr static int kBufferSize = 2048;
+// libsvm 文本解析。文件被 mmap 后按换行切成若干块并行解析：
+// 第一遍数出每块的行数以确定各块的起始行号，第二遍直接写入 FeatureMatrix 的列中
+struct LibsvmParser {
+  constexpr static size_t kMinChunkSize = 1 << 20;
+
+  struct Chunk {
+    const char *begin, *end;
+    int first_row;
+    int rows_count;
+  };
+
+  static bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  static const char *SkipSpaces(const char *p, const char *end) {
+    while (p < end && IsSpace(*p)) ++p;
+    return p;
+  }
+
+  static const char *LineEnd(const char *p, const char *end) {
+    auto found = static_cast<const char*>(memchr(p, '\n', end - p));
+    return found ? found : end;
+  }
+
+  // 只有空白的行不算作一条记录
+  static bool IsRecord(const char *p, const char *line_end) {
+    return SkipSpaces(p, line_end) < line_end;
+  }
 
-  DataReader(const std::string &filename) {
-    printf("Reading data...\n");
-    std::ifstream ifs;
-    ifs.open(filename);
-    if (!ifs.good()) {
-      throw std::string("File not opened");
+  // 支持 0/1 与 -1/+1 两种二分类标签
+  static LabelType ParseLabel(const char *&p, const char *end) {
+    if (p < end && *p == '+') ++p;
+    double val = 0.0;
+    auto res = std::from_chars(p, end, val);
+    if (res.ec != std::errc()) {
+      throw std::string("Malformed label");
     }
-    char buffer[kBufferSize] = {};
+    p = res.ptr;
+    if (val == 1.0) return 1;
+    if (val == 0.0 || val == -1.0) return 0;
+    throw std::string("Unsupported label ") + std::to_string(val);
+  }
+
+  // 解析一行 (不含换行符)，对每个特征调用 on_feature(index, val)
+  template <typename F>
+  static LabelType ParseLine(const char *p, const char *line_end, F &&on_feature) {
+    p = SkipSpaces(p, line_end);
+    auto label = ParseLabel(p, line_end);
+    while (true) {
+      p = SkipSpaces(p, line_end);
+      if (p >= line_end) break;
+      int index = 0;
+      auto res = std::from_chars(p, line_end, index);
+      if (res.ec != std::errc() || res.ptr >= line_end || *res.ptr != ':') {
+        throw std::string("Malformed feature: ") + std::string(p, line_end);
+      }
+      FeatureVal val = 0.0;
+      auto val_res = std::from_chars(res.ptr + 1, line_end, val);
+      if (val_res.ec != std::errc()) {
+        throw std::string("Malformed feature: ") + std::string(p, line_end);
+      }
+      on_feature(index, val);
+      p = val_res.ptr;
+    }
+    return label;
+  }
+
+  // 按换行对齐切块，每块至少 kMinChunkSize
+  static std::vector<Chunk> SplitChunks(const char *data, size_t size, int chunks_count) {
+    std::vector<Chunk> chunks;
+    size_t chunk_size = std::max(kMinChunkSize, size / std::max(chunks_count, 1) + 1);
+    const char *end = data + size;
+    const char *p = data;
+    while (p < end) {
+      const char *chunk_end = size_t(end - p) <= chunk_size ? end : p + chunk_size;
+      if (chunk_end < end) chunk_end = std::min(end, LineEnd(chunk_end, end) + 1);
+      chunks.push_back({ p, chunk_end, 0, 0 });
+      p = chunk_end;
+    }
+    return chunks;
+  }
+
+  static int CountRecords(const char *p, const char *end) {
     int count = 0;
-    while (!ifs.eof()) {
-      ifs.getline(buffer, kBufferSize);
-      std::vector<std::string> line_split;
-      SplitString(line_split, buffer, " ");
-      if (line_split.empty()) continue;
-      ++count;
-      if (count % 100000 == 0) printf("Readed %d records\n", count);
-      std::unordered_map<int, double> data;
-      for (int i = 1; i < line_split.size(); ++i) {
-        // i == 0 is label
-        int index = 0;
-        double val = 0.0;
-        sscanf(line_split[i].c_str(), "%d:%lf", &index, &val);
-        data[index] = val;
+    while (p < end) {
+      auto line_end = LineEnd(p, end);
+      if (IsRecord(p, line_end)) ++count;
+      p = line_end + 1;
+    }
+    return count;
+  }
+
+  // 串行地把 [p, end) 解析为 CSR，每行按特征下标排序，重复的下标保留最后一个
+  static void ParseCsr(const char *p, const char *end, int features_count, CsrMatrix &csr) {
+    csr = CsrMatrix();
+    csr.features_count = features_count;
+    std::vector<std::pair<int, FeatureVal>> row;
+    while (p < end) {
+      auto line_end = LineEnd(p, end);
+      if (IsRecord(p, line_end)) AppendCsrRow(p, line_end, csr, row);
+      p = line_end + 1;
+    }
+  }
+
+  // 把一行 (不含换行符) 追加到 csr，row 为复用的缓冲区。格式错误时抛出异常，csr 不变
+  static void AppendCsrRow(const char *p, const char *line_end, CsrMatrix &csr,
+    std::vector<std::pair<int, FeatureVal>> &row) {
+    int features_count = csr.features_count;
+    row.clear();
+    auto label = ParseLine(p, line_end, [&row, features_count](int index, FeatureVal val) {
+      if (index >= 0 && index < features_count) row.push_back({ index, val });
+    });
+    // libsvm 要求下标升序，通常无需排序
+    if (!std::is_sorted(row.begin(), row.end(), [](const std::pair<int, FeatureVal> &lhs,
+      const std::pair<int, FeatureVal> &rhs) { return lhs.first < rhs.first; })) {
+      std::stable_sort(row.begin(), row.end(), [](const std::pair<int, FeatureVal> &lhs,
+        const std::pair<int, FeatureVal> &rhs) { return lhs.first < rhs.first; });
+    }
+    for (int i = 0; i < row.size(); ++i) {
+      if (i + 1 < row.size() && row[i + 1].first == row[i].first) continue;
+      csr.feature_indexes.push_back(row[i].first);
+      csr.values.push_back(row[i].second);
+    }
+    csr.EndRow(label);
+  }
+
+  // 解析 [data, data + size) 到 matrix，超出 features_count 的特征被丢弃
+  static void Parse(const char *data, size_t size, int features_count, ThreadPool &pool,
+    FeatureMatrix &matrix) {
+    PROFILE_SCOPE("ParseLibsvm");
+    PROFILE_COUNT(kBytesRead, size);
+    auto chunks = SplitChunks(data, size, pool.Size() * 4);
+    pool.ParallelFor(0, chunks.size(), 1, [&chunks](int begin, int end) {
+      for (int i = begin; i < end; ++i) {
+        chunks[i].rows_count = CountRecords(chunks[i].begin, chunks[i].end);
       }
-      constexpr char kZero = '0';
-      LabelType label = line_split[0][0] - kZero;
-      samples.push_back({ label, std::move(data) });
+    });
+    int rows_count = 0;
+    for (auto &chunk : chunks) {
+      chunk.first_row = rows_count;
+      rows_count += chunk.rows_count;
+    }
+    matrix = FeatureMatrix(rows_count, features_count);
+    pool.ParallelFor(0, chunks.size(), 1, [&chunks, &matrix, features_count](int begin, int end) {
+      for (int i = begin; i < end; ++i) {
+        int row = chunks[i].first_row;
+        const char *p = chunks[i].begin;
+        while (p < chunks[i].end) {
+          auto line_end = LineEnd(p, chunks[i].end);
+          if (IsRecord(p, line_end)) {
+            matrix.labels[row] = ParseLine(p, line_end,
+              [&matrix, row, features_count](int index, FeatureVal val) {
+                // 重复的下标保留最后一个
+                if (index >= 0 && index < features_count) matrix.MutableColumn(index)[row] = val;
+              });
+            ++row;
+          }
+          p = line_end + 1;
+        }
+      }
+    });
+  }
+};
+
+struct DataReader {
+  // build_bins 为 true 时同时计算分位数切分点 (直方图分裂模式需要)
+  // threading 的含义与 RandomForest 相同
+  // use_cache 为 true 时优先读取 <filename>.cache，不存在或已失效时解析文本并重新生成
+  DataReader(const std::string &filename, int features_count, bool build_bins = false,
+    int threading = -1, bool use_cache = true) {
+    PROFILE_SCOPE("ReadData");
+    // 进度写到 stderr，stdout 可能用于输出打分结果 (rf score ... -o -)
+    fprintf(stderr, "Reading data...\n");
+    auto start = high_clock::now();
+    MappedFile file(filename);
+    auto cache_filename = DataCache::CacheFilename(filename);
+    SourceFingerprint fingerprint;
+    if (use_cache) fingerprint = DataCache::Fingerprint(filename, file);
+    if (use_cache && DataCache::Load(cache_filename, fingerprint, features_count, matrix)) {
+      double seconds = duration_cast<duration<double>>(high_clock::now() - start).count();
+      fprintf(stderr, "Total: %d records from %s in %lf s\n", matrix.rows_count,
+        cache_filename.c_str(), seconds);
+    } else {
+      file.AdviseSequential();
+      {
+        ThreadPool pool(ThreadCount(threading));
+        LibsvmParser::Parse(file.Data(), file.Size(), features_count, pool, matrix);
+      }
+      double seconds = duration_cast<duration<double>>(high_clock::now() - start).count();
+      fprintf(stderr, "Total: %d records, %.1lf MB in %lf s (%.1lf MB/s)\n",
+        matrix.rows_count, file.Size() / 1e6, seconds, file.Size() / 1e6 / seconds);
+      if (use_cache && !DataCache::Save(cache_filename, fingerprint, matrix)) {
+        fprintf(stderr, "Cannot write data cache %s\n", cache_filename.c_str());
+      }
+    }
+    if (build_bins) {
+      fprintf(stderr, "Building feature bins...\n");
+      PROFILE_SCOPE("BuildBins");
+      matrix.BuildBins();
     }
-    printf("Total: %d records\n", count);
   }
 
-  std::vector<Sample> samples;
+  FeatureMatrix matrix;
 };
 
 #endif
@@ -4,8 +4,13 @@
 #include <cassert>
 #include <vector>
 #include <memory>
-#include <functional>
-#include "sample.h"
+#include <atomic>
+#include <numeric>
+#include "feature-matrix.h"
+#include "sparse-columns.h"
+#include "split-criterion.h"
+#include "thread-pool.h"
+#include "profiler.h"
 #include "util.h"
 #include <random>
 #include <algorithm>
@@ -13,19 +18,32 @@
 
 // #define NO_SORT
 
-using SamplePtrVec = std::vector<const Sample*>;
-using LabelType = char;
-
 struct DecisionTree {
-  DecisionTree(const std::function<double (const SamplePtrVec&)> &func,
-    const Logger &logger = Logger(), int id = 0)
-    : CalcCoeff(func), logger(logger), id(id) {}
+  // kExact: 在 SparseColumns 上只扫描非 0 值的精确搜索
+  //   (没有 SparseColumns 时对结点排序后扫描，定义 NO_SORT 时为逐样本尝试)
+  // kHist: 在 FeatureMatrix::bins 上用直方图扫描
+  enum class SplitMode { kExact, kHist };
+  // kDepthFirst: 递归地先建完左子树再建右子树
+  // kLevelWise: 逐层建树，每层一次为所有待分裂的结点统计 (见 BuildTreeLevelWise)
+  enum class GrowMode { kDepthFirst, kLevelWise };
+
+  // 所有特征拼接起来的直方图，第 (bin_offsets[f] + b) 个桶占 [2 * i, 2 * i + 2)，
+  // 分别为标签 0 和 1 的计数
+  using Histogram = std::vector<int>;
+
+  DecisionTree(const Logger &logger = Logger(), int id = 0) : logger(logger), id(id) {}
 
   struct DecisionTreeInfo {
     int features_count;
     int max_features;
     int max_depth = 10;
     int min_samples_split = 2;
+    SplitMode split_mode = SplitMode::kExact;
+    GrowMode grow_mode = GrowMode::kDepthFirst;
+    // 只由 RandomForest 在构造时使用，选定建树函数的模板参数
+    SplitCriterion criterion = SplitCriterion::kGini;
+    // 样本数不少于该值的结点才在线程池上并行 (候选特征并行打分、两侧子树并行建树)
+    int parallel_cutoff = 2048;
     // int min_samples_leaf = 1;
     // int min_weight_fraction_leaf;
     // int max_leaf_nodes;
@@ -37,238 +55,903 @@ struct DecisionTree {
     max_features = info.max_features;
     max_depth = info.max_depth;
     min_samples_split = info.min_samples_split;
+    split_mode = info.split_mode;
+    grow_mode = info.grow_mode;
+    parallel_cutoff = info.parallel_cutoff;
     // min_samples_leaf = info.min_samples_leaf;
     // min_impurity_split = info.min_impurity_split;
   }
 
-  struct SplitRes {
-    SamplePtrVec left, right;
-  };
+  // 结点的样本为 indexes 中的 [begin, end)，按 value < split_value 原地划分，
+  // slots 随 indexes 一起交换，返回右侧的起点
+  inline int Partition(int begin, int end, int feature_index, double split_value) {
+    PROFILE_COUNT(kSamplesPartitioned, end - begin);
+    auto column = matrix->Column(feature_index);
+    int i = begin, j = end;
+    while (true) {
+      while (i < j && column[indexes[i]] < split_value) ++i;
+      while (i < j && !(column[indexes[j - 1]] < split_value)) --j;
+      if (i >= j) return i;
+      --j;
+      std::swap(indexes[i], indexes[j]);
+      std::swap(slots[i], slots[j]);
+      ++i;
+    }
+  }
 
-  inline SplitRes GetSplit(const SamplePtrVec &samples, int feature_index, double split_value) {
-    SamplePtrVec left, right;
-    left.reserve(200);
-    right.reserve(200);
-    for (auto &sample : samples) {
-      if ((*sample)[feature_index] < split_value) {
-        left.push_back(sample);
-      } else {
-        right.push_back(sample);
-      }
+  // exact 模式下 slot 所在的结点，用结点的样本区间在整棵树的 indexes 中的起点标识。
+  // 同一时刻所有叶结点与待建结点的区间互不相交，因此标识不会重复
+  int SlotNode(int slot) const {
+    return slot_node[slot].load(std::memory_order_relaxed);
+  }
+
+  // 把 indexes 中 [begin, end) 的 slot 标为以 begin 为起点的结点
+  void LabelSlots(int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      slot_node[slots[i]].store(position_base + begin, std::memory_order_relaxed);
     }
-    return { std::move(left), std::move(right) };
+  }
+
+  // 为 indexes 中的全部样本建立 SparseColumns，并把所有 slot 标为根结点
+  SparseColumns BuildSparseColumns() {
+    PROFILE_SCOPE("SparseColumns");
+    slots.resize(indexes.size());
+    std::iota(slots.begin(), slots.end(), 0);
+    slot_node.reset(new std::atomic<int>[indexes.size()]);
+    position_base = 0;
+    LabelSlots(0, indexes.size());
+    // 两种做法分别读取 indexes.size() * features_count 个值和矩阵的全部非 0 值
+    if (matrix_columns
+      && size_t(indexes.size()) * features_count >= matrix_columns->NonZerosCount()) {
+      return matrix_columns->Select(indexes, pool, parallel_cutoff);
+    }
+    return SparseColumns::Build(*matrix, indexes, pool, parallel_cutoff);
   }
 
   struct BestSplitRes {
-    int feature_index;
-    double feature_val;
-    SamplePtrVec left, right;
+    int feature_index = -1;
+    double feature_val = 0.0;
   };
 
-  BestSplitRes GetBestSplit(const SamplePtrVec &samples, const std::vector<int> &feature_indexes) {
-    TikTok tt("GetBestSplit");
-    // tt.Tik();
-    BestSplitRes res;
-    double min_gini = 1e8;
-    // 对每一个(选中的)特征
-    for (auto &feature_index : feature_indexes) {
-      // 对每一个样本
-      TikTok tt("OneFeature");
-      // printf("sample size: %lu\n", samples.size());
-      // tt.Tik();
-      #ifdef NO_SORT
-      for (auto &sample : samples) {
-        auto split_res = GetSplit(samples, feature_index, (*sample)[feature_index]);
-        // 计算该分裂的指标值(Gini不纯度/信息增量)
-        auto gini = CalcCoeff(split_res.left) + CalcCoeff(split_res.right);
-        if (gini < min_gini) {
-          // 如果是当前最小的 Gini，则使用该分裂
-          min_gini = gini;
-          res.feature_index = feature_index;
-          res.feature_val = (*sample)[feature_index];
-          res.left = split_res.left;
-          res.right = split_res.right;
+  int CountLabel0(int begin, int end) const {
+    auto labels = matrix->Labels();
+    return std::count_if(indexes.begin() + begin, indexes.begin() + end, [labels](int sample) {
+      return labels[sample] == 0;
+    });
+  }
+
+  // 一个特征上的最优阈值，没有可用的分裂时 gini 保持为 kNoSplit
+  constexpr static double kNoSplit = 1e8;
+  struct FeatureSplit {
+    double gini = kNoSplit;
+    double feature_val = 0.0;
+  };
+
+  // 只比较左右两侧的标签计数，候选分裂的打分不再构造子集，由 Criterion::Score 计算
+  // sort_samples 为长度至少 end - begin 的排序缓冲区
+  template <typename Criterion>
+  FeatureSplit GetBestFeatureSplit(int begin, int end, int feature_index, int total_0_count,
+    int *sort_samples) const {
+    FeatureSplit res;
+    auto labels = matrix->Labels();
+    int total_count = end - begin;
+    auto column = matrix->Column(feature_index);
+    #ifdef NO_SORT
+    for (int i = begin; i < end; ++i) {
+      auto split_value = column[indexes[i]];
+      int left_count = 0, left_0_count = 0;
+      for (int j = begin; j < end; ++j) {
+        if (column[indexes[j]] < split_value) {
+          ++left_count;
+          if (labels[indexes[j]] == 0) ++left_0_count;
         }
       }
-      #else
-      SamplePtrVec sort_samples = samples;
-      std::sort(sort_samples.begin(), sort_samples.end(), [feature_index](auto lhs, auto rhs) {
-        return (*lhs)[feature_index] < (*rhs)[feature_index];
-      });
-      // Use sort
-      for (int mid = 0; mid < sort_samples.size(); ++mid) {
-        SamplePtrVec left;
-        for (int i = 0; i < mid; ++i) {
-          left.push_back(sort_samples[i]);
+      if (left_count == 0) continue;
+      // 计算该分裂的指标值(Gini不纯度/信息增量)
+      auto gini = Criterion::Score(left_0_count, left_count,
+        total_0_count - left_0_count, total_count - left_count);
+      if (gini < res.gini) {
+        // 如果是当前最小的 Gini，则使用该分裂
+        res.gini = gini;
+        res.feature_val = split_value;
+      }
+    }
+    #else
+    // 稀疏数据中大部分值是 0 (缺失的特征)：只收集并排序非 0 的样本，全部为 0 的一段
+    // 作为一个整体插在负数与正数之间，它的标签计数由结点的总数减去非 0 的部分得到。
+    // 排序的代价只与该特征在结点中非 0 的个数有关，得到的分裂与整体排序时完全相同
+    int nonzero_count = 0, nonzero_0_count = 0;
+    for (int i = begin; i < end; ++i) {
+      auto sample = indexes[i];
+      sort_samples[nonzero_count] = sample;
+      bool nonzero = column[sample] != 0.0;
+      nonzero_count += nonzero;
+      nonzero_0_count += nonzero && labels[sample] == 0;
+    }
+    std::sort(sort_samples, sort_samples + nonzero_count, [column](int lhs, int rhs) {
+      return column[lhs] < column[rhs];
+    });
+    int negative_count = std::partition_point(sort_samples, sort_samples + nonzero_count,
+      [column](int sample) { return column[sample] < 0.0; }) - sort_samples;
+    // 从左到右扫描一遍，维护左侧的标签计数，每个阈值 O(1) 打分。
+    // 阈值为下一段的值，而测试时 < 阈值才走左侧，因此相同特征值的一段不能被拆开
+    int left_count = 0, left_0_count = 0;
+    double last_val = 0.0;
+    long long evaluated = 0;
+    auto append = [&](double val, int count, int count_0) {
+      if (left_count > 0 && last_val < val) {
+        ++evaluated;
+        auto gini = Criterion::Score(left_0_count, left_count,
+          total_0_count - left_0_count, total_count - left_count);
+        if (gini < res.gini) {
+          // 如果是当前最小的 Gini，则使用该分裂
+          res.gini = gini;
+          res.feature_val = val;
         }
-        SamplePtrVec right;
-        for (int i = mid; i < sort_samples.size(); ++i) {
-          right.push_back(sort_samples[i]);
+      }
+      left_count += count;
+      left_0_count += count_0;
+      last_val = val;
+    };
+    for (int i = 0; i < negative_count; ++i) {
+      append(column[sort_samples[i]], 1, labels[sort_samples[i]] == 0);
+    }
+    if (nonzero_count < total_count) {
+      append(0.0, total_count - nonzero_count, total_0_count - nonzero_0_count);
+    }
+    for (int i = negative_count; i < nonzero_count; ++i) {
+      append(column[sort_samples[i]], 1, labels[sort_samples[i]] == 0);
+    }
+    PROFILE_COUNT(kSplitsEvaluated, evaluated);
+    #endif
+    return res;
+  }
+
+  // 结点在一个特征上的扫描状态，只看非 0 的值：负数从小到大、正数从大到小各扫描一遍，
+  // 0 这一段的计数由结点的总数减去两侧得到。候选阈值按负数、0、正数三组分别取最优，
+  // 再按阈值从小到大的顺序取第一个最小值，与对整个结点排序后扫描的结果相同
+  template <typename Criterion>
+  struct SparseSweep {
+    SparseSweep(int total_count, int total_0_count)
+      : total_count(total_count), total_0_count(total_0_count) {}
+
+    void AddNegative(FeatureVal val, LabelType label) {
+      if (neg_count > 0 && neg_last < val) {
+        Try(neg_best, neg_0_count, neg_count, val, false);
+      }
+      ++neg_count;
+      neg_0_count += label == 0;
+      neg_last = val;
+    }
+
+    // 从大到小扫描时，值为 pos_last 的一段在遇到更小的值时结束，
+    // 此时 < pos_last 的样本都在左侧
+    void AddPositive(FeatureVal val, LabelType label) {
+      if (pos_count > 0 && val < pos_last) TryPositive();
+      ++pos_count;
+      pos_0_count += label == 0;
+      pos_last = val;
+    }
+
+    FeatureSplit Finish() {
+      if (pos_count > 0) TryPositive();
+      FeatureSplit res = neg_best;
+      if (neg_count > 0 && neg_count + pos_count < total_count) {
+        Try(res, neg_0_count, neg_count, 0.0, false);
+      }
+      if (pos_best.gini < res.gini) res = pos_best;
+      PROFILE_COUNT(kSplitsEvaluated, evaluated);
+      return res;
+    }
+
+    void TryPositive() {
+      int left_count = total_count - pos_count;
+      if (left_count > 0) {
+        // 从大到小扫描，分数相同时取较小的阈值
+        Try(pos_best, total_0_count - pos_0_count, left_count, pos_last, true);
+      }
+    }
+
+    void Try(FeatureSplit &best, int left_0_count, int left_count, FeatureVal val,
+      bool or_equal) {
+      ++evaluated;
+      auto gini = Criterion::Score(left_0_count, left_count,
+        total_0_count - left_0_count, total_count - left_count);
+      if (gini < best.gini || (or_equal && gini == best.gini)) best = { gini, val };
+    }
+
+    int total_count, total_0_count;
+    int neg_count = 0, neg_0_count = 0;
+    int pos_count = 0, pos_0_count = 0;
+    FeatureVal neg_last = 0.0, pos_last = 0.0;
+    FeatureSplit neg_best, pos_best;
+    long long evaluated = 0;
+  };
+
+  // 按 state_of(slot) 把 f 列的非 0 值交给各自的 SparseSweep，state_of 返回空时跳过该项
+  template <typename Sweep, typename StateOf>
+  static void SweepColumn(const SparseColumns &columns, int f, StateOf &&state_of) {
+    auto &entries = columns.columns[f];
+    int positive_begin = columns.positive_begins[f];
+    for (int i = 0; i < positive_begin; ++i) {
+      Sweep *state = state_of(entries[i].slot);
+      if (state) state->AddNegative(entries[i].val, entries[i].label);
+    }
+    for (int i = entries.size() - 1; i >= positive_begin; --i) {
+      Sweep *state = state_of(entries[i].slot);
+      if (state) state->AddPositive(entries[i].val, entries[i].label);
+    }
+  }
+
+  // 在 columns 上搜索 [begin, end) 的结点在一个特征上的最优阈值，
+  // columns 应至少覆盖该结点的 slot，代价与 columns 中该列的长度成正比
+  template <typename Criterion>
+  FeatureSplit GetBestSparseFeatureSplit(const SparseColumns &columns, int begin, int end,
+    int feature_index, int total_0_count) const {
+    SparseSweep<Criterion> sweep(end - begin, total_0_count);
+    int key = position_base + begin;
+    SweepColumn<SparseSweep<Criterion>>(columns, feature_index, [this, key, &sweep](int slot) {
+      return SlotNode(slot) == key ? &sweep : nullptr;
+    });
+    return sweep.Finish();
+  }
+
+  // columns 不为空时在其上只扫描非 0 值，否则对结点的样本排序后扫描
+  template <typename Criterion>
+  BestSplitRes GetBestSplit(int begin, int end, const std::vector<int> &feature_indexes,
+    const SparseColumns *columns = nullptr) {
+    PROFILE_SCOPE("GetBestSplit");
+    int total_0_count = CountLabel0(begin, end);
+    std::vector<FeatureSplit> splits(feature_indexes.size());
+    if (columns) {
+      auto search = [this, columns, begin, end, total_0_count, &feature_indexes, &splits](
+        int first, int last) {
+        for (int i = first; i < last; ++i) {
+          splits[i] = GetBestSparseFeatureSplit<Criterion>(*columns, begin, end,
+            feature_indexes[i], total_0_count);
         }
-        auto gini = CalcCoeff(left) + CalcCoeff(right);
-        // printf("gini: %lf\n", gini);
-        if (gini < min_gini) {
-          // 如果是当前最小的 Gini，则使用该分裂
-          min_gini = gini;
-          res.feature_index = feature_index;
-          res.feature_val = sort_samples[mid]->operator[](feature_index);
-          res.left = left;
-          res.right = right;
+      };
+      if (pool && end - begin >= parallel_cutoff) {
+        pool->ParallelFor(0, feature_indexes.size(), 1, search);
+      } else {
+        search(0, feature_indexes.size());
+      }
+    } else if (pool && end - begin >= parallel_cutoff) {
+      // 候选特征并行打分，每个任务使用自己的排序缓冲区
+      pool->ParallelFor(0, feature_indexes.size(), 1,
+        [this, begin, end, total_0_count, &feature_indexes, &splits](int first, int last) {
+          RowIndexVec sort_samples(end - begin);
+          for (int i = first; i < last; ++i) {
+            splits[i] = GetBestFeatureSplit<Criterion>(begin, end, feature_indexes[i], total_0_count,
+              sort_samples.data());
+          }
+        });
+    } else {
+      // 建树时 exact 模式总是给出 columns，这里只在测试和基准中用到，缓冲区临时分配
+      RowIndexVec sort_samples(end - begin);
+      for (int i = 0; i < feature_indexes.size(); ++i) {
+        splits[i] = GetBestFeatureSplit<Criterion>(begin, end, feature_indexes[i], total_0_count,
+          sort_samples.data());
+      }
+    }
+    return MergeFeatureSplits(feature_indexes, splits);
+  }
+
+  // splits[i] 为特征 feature_indexes[i] 上的最优阈值。按特征的顺序合并，
+  // 与逐个特征扫描一样取第一个最小值
+  static BestSplitRes MergeFeatureSplits(const std::vector<int> &feature_indexes,
+    const std::vector<FeatureSplit> &splits) {
+    BestSplitRes res;
+    double min_gini = kNoSplit;
+    for (int i = 0; i < feature_indexes.size(); ++i) {
+      if (splits[i].gini < min_gini) {
+        min_gini = splits[i].gini;
+        res.feature_index = feature_indexes[i];
+        res.feature_val = splits[i].feature_val;
+      }
+    }
+    return res;
+  }
+
+  // 把 [begin, end) 的样本在 features 各特征上的计数累加到 hist
+  void AddToHistogram(int begin, int end, const std::vector<int> &features,
+    Histogram &hist) const {
+    PROFILE_SCOPE("Histogram");
+    auto &bins = matrix->bins;
+    auto labels = matrix->Labels();
+    // 各特征写入直方图中不相交的区间，样本多时按特征并行统计
+    auto count_features = [this, begin, end, &features, &bins, labels, &hist](int first,
+      int last) {
+      for (int k = first; k < last; ++k) {
+        auto bin_column = bins.Column(features[k]);
+        auto f_hist = hist.data() + bins.bin_offsets[features[k]] * 2;
+        for (int i = begin; i < end; ++i) {
+          auto sample = indexes[i];
+          ++f_hist[bin_column[sample] * 2 + labels[sample]];
         }
       }
-      #endif
-      // tt.Tok();
+    };
+    if (pool && end - begin >= parallel_cutoff) {
+      pool->ParallelFor(0, features.size(), 0, count_features);
+    } else {
+      count_features(0, features.size());
+    }
+  }
+
+  Histogram BuildHistogram(int begin, int end) const {
+    Histogram hist(matrix->bins.TotalBinsCount() * 2, 0);
+    std::vector<int> features(features_count);
+    for (int f = 0; f < features_count; ++f) features[f] = f;
+    AddToHistogram(begin, end, features, hist);
+    return hist;
+  }
+
+  // 与 GetBestSplit 相同，但只在桶的边界上尝试分裂，每个特征的代价只与桶数有关
+  template <typename Criterion>
+  BestSplitRes GetBestSplitHist(int begin, int end, const Histogram &hist,
+    const std::vector<int> &feature_indexes) {
+    auto &bins = matrix->bins;
+    int total_count = end - begin;
+    int total_0_count = CountLabel0(begin, end);
+    long long evaluated = 0;
+    std::vector<FeatureSplit> splits(feature_indexes.size());
+    for (int i = 0; i < feature_indexes.size(); ++i) {
+      auto f_hist = hist.data() + bins.bin_offsets[feature_indexes[i]] * 2;
+      splits[i] = GetBestFeatureSplitHist<Criterion>(f_hist, feature_indexes[i], total_count,
+        total_0_count, evaluated);
+    }
+    PROFILE_COUNT(kSplitsEvaluated, evaluated);
+    return MergeFeatureSplits(feature_indexes, splits);
+  }
+
+  // f_hist 为结点在一个特征上的直方图，evaluated 累加尝试过的阈值个数
+  template <typename Criterion>
+  FeatureSplit GetBestFeatureSplitHist(const int *f_hist, int feature_index, int total_count,
+    int total_0_count, long long &evaluated) const {
+    auto &bins = matrix->bins;
+    FeatureSplit res;
+    int bins_count = bins.BinsCount(feature_index);
+    int left_count = 0, left_0_count = 0;
+    // 分裂为 bin <= b 与 bin > b，即 value < cuts[b]
+    for (int b = 0; b + 1 < bins_count; ++b) {
+      left_0_count += f_hist[b * 2];
+      left_count += f_hist[b * 2] + f_hist[b * 2 + 1];
+      if (left_count == 0) continue;
+      if (left_count == total_count) break;
+      ++evaluated;
+      auto gini = Criterion::Score(left_0_count, left_count,
+        total_0_count - left_0_count, total_count - left_count);
+      if (gini < res.gini) {
+        res.gini = gini;
+        res.feature_val = bins.cuts[feature_index][b];
+      }
     }
-    // tt.Tok();
     return res;
   }
 
+  // 结点按建树顺序紧凑存放，只包含实际存在的结点。兄弟结点相邻：
+  // 内部结点的左孩子为 nodes[child]，右孩子为 nodes[child + 1]；
+  // 叶结点的 feature_index 为 kLeaf，child 为其标签在 leaf_labels 中的下标
   struct TreeNode {
-    // -1 for not leaf, -2 for nothing, 0/1 for tag
-    LabelType label;
-    int feature_index;
     double feature_val;
+    int feature_index;
+    int child;
   };
+  constexpr static int kLeaf = -1;
 
-  TreeNode *tree = nullptr;
+  std::vector<TreeNode> nodes;
+  // 0/1 for tag, -2 for nothing
+  std::vector<LabelType> leaf_labels;
 
-  LabelType GetLabel(const SamplePtrVec &samples) {
-    if (samples.empty()) {
+  // 从模型文件 mmap 加载的树不持有 nodes/leaf_labels，直接指向映射的内存
+  const TreeNode *mapped_nodes = nullptr;
+  const LabelType *mapped_leaf_labels = nullptr;
+  int mapped_nodes_count = 0;
+  int mapped_leaves_count = 0;
+
+  const TreeNode *Nodes() const { return mapped_nodes ? mapped_nodes : nodes.data(); }
+  const LabelType *LeafLabels() const {
+    return mapped_nodes ? mapped_leaf_labels : leaf_labels.data();
+  }
+  int NodesCount() const { return mapped_nodes ? mapped_nodes_count : nodes.size(); }
+  int LeavesCount() const { return mapped_nodes ? mapped_leaves_count : leaf_labels.size(); }
+
+  // 返回新结点的下标，新结点先作为空叶子
+  int AddNodes(int count) {
+    int first = nodes.size();
+    nodes.resize(first + count, { 0.0, kLeaf, -1 });
+    return first;
+  }
+
+  void SetLeaf(int node_index, LabelType label) {
+    PROFILE_COUNT(kNodesBuilt, 1);
+    nodes[node_index].feature_index = kLeaf;
+    nodes[node_index].child = leaf_labels.size();
+    leaf_labels.push_back(label);
+  }
+
+  LabelType GetLabel(int begin, int end) {
+    if (begin == end) {
       return -2;
     }
-    auto label_0_count = std::count_if(samples.begin(), samples.end(), [](const Sample* sample) {
-      return sample->label == 0;
-    });
-    return label_0_count > (samples.size() - label_0_count) ? 0 : 1;
+    auto label_0_count = CountLabel0(begin, end);
+    return label_0_count > (end - begin - label_0_count) ? 0 : 1;
+  }
+
+  // 位于 path 的结点随机选取的 max_features 个特征
+  std::vector<int> ChooseFeatures(uint64_t path) const {
+    Randomer randomer(seed, path);
+    return randomer.Sample(features_count, max_features);
+  }
+
+  // 写入分裂信息到该结点，为两个孩子分配相邻的位置并原地划分样本，返回右侧的起点
+  int ApplySplit(int begin, int end, int node_index, const BestSplitRes &split) {
+    PROFILE_COUNT(kNodesBuilt, 1);
+    int child = AddNodes(2);
+    nodes[node_index].feature_index = split.feature_index;
+    nodes[node_index].feature_val = split.feature_val;
+    nodes[node_index].child = child;
+    return Partition(begin, end, split.feature_index, split.feature_val);
   }
 
-  void BuildTreeRecursive(const SamplePtrVec &samples, int depth, int building_node_index) {
+  // 结点的样本为 indexes 中的 [begin, end)，分裂后原地划分为左右两段
+  // hist 仅在 kHist 模式下使用，为该结点的直方图
+  // columns 仅在 kExact 模式下使用，覆盖该结点的 slot。结点的样本不到它覆盖的一半时，
+  // 先从中筛出只含该结点的一份给整棵子树使用，每个结点扫描的列长不超过自身非 0 值的约两倍
+  // path 标识结点在树中的位置，结点的随机数流由 (seed, path) 决定，与建树顺序无关
+  template <typename Criterion>
+  void BuildTreeRecursive(int begin, int end, int depth, int building_node_index,
+    uint64_t path, Histogram hist = Histogram(), const SparseColumns *columns = nullptr) {
     // logger.Debug("%d building depth %d", id, depth);
     // 检测是否应该结束建树
-    if (samples.empty()) {
+    if (begin == end) {
       // 如果该分组为空，停止建树，贴上标签
       // 然而由于上层递归已经判断，不应有该情况，因此改为断言
       assert(false && "此处不应该出现该情况，调试进入循环的代码");
       return;
     }
 
+    SparseColumns subtree_columns;
+    if (columns && (end - begin) * 2 <= columns->slots_count) {
+      int key = position_base + begin;
+      subtree_columns = columns->Filter([this, key](int slot) { return SlotNode(slot) == key; },
+        end - begin, pool, parallel_cutoff);
+      columns = &subtree_columns;
+    }
+
     // 对当前结点
     // 随机选取 max_features 个 feature
-    std::vector<int> chosen_feature_index;
-    for (int i = 0; i < max_features; ++i) {
-      int rand_index = Randomer::RandInt(0, features_count);
-      while (std::find(chosen_feature_index.begin(),
-        chosen_feature_index.end(),
-        rand_index) != chosen_feature_index.end()) {
-        rand_index = Randomer::RandInt(0, features_count);
-      }
-      chosen_feature_index.push_back(rand_index);
-    }
+    auto chosen_feature_index = ChooseFeatures(path);
     // 寻找该结点使用哪个样本的哪个特征进行分裂
-    auto best_split_res = GetBestSplit(samples, chosen_feature_index);
-    // 写入分裂信息到该结点
-    tree[building_node_index].feature_index = best_split_res.feature_index;
-    tree[building_node_index].feature_val = best_split_res.feature_val;
-    tree[building_node_index].label = -1;
+    auto best_split_res = split_mode == SplitMode::kHist
+      ? GetBestSplitHist<Criterion>(begin, end, hist, chosen_feature_index)
+      : GetBestSplit<Criterion>(begin, end, chosen_feature_index, columns);
     // 检测分裂结果，是否继续建树
-    // 如果某侧分裂结果为空，强制产生叶结点，以结果中最多的标签作为结点标签
-    if (best_split_res.left.empty() || best_split_res.right.empty()) {
-      // tree[building_node_index * 2].label = tree[building_node_index * 2 + 1].label
-      //   = GetLabel(MergeVectors(best_split_res.left, best_split_res.right));
-      tree[building_node_index].label = GetLabel(samples);
+    // 如果没有可用的分裂 (某侧为空)，强制产生叶结点，以结果中最多的标签作为结点标签
+    if (best_split_res.feature_index < 0) {
+      SetLeaf(building_node_index, GetLabel(begin, end));
       return;
     }
+    // 写入分裂信息到该结点，并为两个孩子分配相邻的位置
+    int mid = ApplySplit(begin, end, building_node_index, best_split_res);
+    int child = nodes[building_node_index].child;
     // 如果深度达到了最大深度，强制产生叶结点
     if (depth + 1 >= max_depth) {  // 下一次的深度恰好到达最大深度时
-      tree[building_node_index * 2].label = GetLabel(best_split_res.left);
-      tree[building_node_index * 2 + 1].label = GetLabel(best_split_res.right);
+      SetLeaf(child, GetLabel(begin, mid));
+      SetLeaf(child + 1, GetLabel(mid, end));
+      return;
+    }
+    bool left_grow = mid - begin > min_samples_split;
+    bool right_grow = end - mid > min_samples_split;
+    // 左孩子的区间起点与本结点相同，只需重新标记右侧
+    if (columns) LabelSlots(mid, end);
+    Histogram left_hist, right_hist;
+    if (split_mode == SplitMode::kHist && (left_grow || right_grow)) {
+      // 只为较小的一侧统计直方图，较大一侧由父结点的直方图相减得到
+      bool left_smaller = mid - begin <= end - mid;
+      auto &small_hist = left_smaller ? left_hist : right_hist;
+      auto &large_hist = left_smaller ? right_hist : left_hist;
+      small_hist = left_smaller ? BuildHistogram(begin, mid) : BuildHistogram(mid, end);
+      if (left_smaller ? right_grow : left_grow) {
+        for (int i = 0; i < hist.size(); ++i) hist[i] -= small_hist[i];
+        large_hist = std::move(hist);
+      }
+    }
+    if (pool && left_grow && right_grow && end - begin >= parallel_cutoff) {
+      // 两侧子树各自在独立的结点数组中建成，左侧作为任务交给线程池；
+      // 完成后按先左后右的顺序拼接，结点布局与串行建树完全相同
+      auto left_tree = Fragment(begin, mid);
+      auto right_tree = Fragment(mid, end);
+      TaskGroup group(*pool);
+      group.Run([&left_tree, &left_hist, depth, path, columns]() {
+        PROFILE_SCOPE("Subtree");
+        left_tree.BuildTreeRecursive<Criterion>(0, left_tree.indexes.size(), depth + 1, 0,
+          ChildPath(path, 0), std::move(left_hist), columns);
+      });
+      right_tree.BuildTreeRecursive<Criterion>(0, right_tree.indexes.size(), depth + 1, 0,
+        ChildPath(path, 1), std::move(right_hist), columns);
+      group.Wait();
+      Splice(left_tree, child);
+      Splice(right_tree, child + 1);
       return;
     }
     // 如果左侧分裂结果太少，强制产生叶结点
-    if (best_split_res.left.size() <= min_samples_split) {
-      tree[building_node_index * 2].label = GetLabel(best_split_res.left);
+    if (!left_grow) {
+      SetLeaf(child, GetLabel(begin, mid));
     } else {
       // 否则，递归建树
-      BuildTreeRecursive(best_split_res.left, depth + 1, building_node_index * 2);
+      BuildTreeRecursive<Criterion>(begin, mid, depth + 1, child, ChildPath(path, 0),
+        std::move(left_hist), columns);
     }
     // 如果右侧分裂结果太少，强制产生叶结点
-    if (best_split_res.right.size() <= min_samples_split) {
-      tree[building_node_index * 2 + 1].label = GetLabel(best_split_res.right);
+    if (!right_grow) {
+      SetLeaf(child + 1, GetLabel(mid, end));
     } else {
       // 否则，递归建树
-      BuildTreeRecursive(best_split_res.right, depth + 1, building_node_index * 2 + 1);
+      BuildTreeRecursive<Criterion>(mid, end, depth + 1, child + 1, ChildPath(path, 1),
+        std::move(right_hist), columns);
+    }
+  }
+
+  // 逐层建树时同一层待分裂的结点，features 为它选取的特征
+  struct OpenNode {
+    int begin, end, node_index;
+    uint64_t path;
+    std::vector<int> features;
+  };
+
+  // 逐层建树。同一层待分裂的结点的样本区间在 indexes 中按顺序排列，
+  // 每一层先一起为所有结点找到分裂 (见 FindLevelSplitsSparse/FindLevelSplitsHist)，
+  // 再依次划分各结点的样本。
+  // 各结点选取的特征和分裂与深度优先时相同，只是结点在数组中的顺序不同
+  template <typename Criterion>
+  void BuildTreeLevelWise(int size, int root) {
+    std::vector<OpenNode> level = { { 0, size, root, kRootPath } }, next_level;
+    SparseColumns columns;
+    // open_of_key[key] 为以 key 标识 (见 SlotNode) 的结点在 level 中的下标，不在时为 -1
+    std::vector<int> open_of_key;
+    if (split_mode == SplitMode::kExact) {
+      columns = BuildSparseColumns();
+      open_of_key.assign(size, -1);
+    }
+    for (int depth = 1; !level.empty(); ++depth) {
+      for (auto &open : level) open.features = ChooseFeatures(open.path);
+      auto splits = split_mode == SplitMode::kHist
+        ? FindLevelSplitsHist<Criterion>(level)
+        : FindLevelSplitsSparse<Criterion>(level, columns, open_of_key);
+      next_level.clear();
+      for (int n = 0; n < level.size(); ++n) {
+        auto &open = level[n];
+        int begin = open.begin, end = open.end;
+        if (splits[n].feature_index < 0) {
+          SetLeaf(open.node_index, GetLabel(begin, end));
+          continue;
+        }
+        int mid = ApplySplit(begin, end, open.node_index, splits[n]);
+        // 左孩子的区间起点与本结点相同，只需重新标记右侧
+        if (split_mode == SplitMode::kExact) LabelSlots(mid, end);
+        int child = nodes[open.node_index].child;
+        if (depth + 1 >= max_depth) {
+          SetLeaf(child, GetLabel(begin, mid));
+          SetLeaf(child + 1, GetLabel(mid, end));
+          continue;
+        }
+        if (mid - begin > min_samples_split) {
+          next_level.push_back({ begin, mid, child, ChildPath(open.path, 0) });
+        } else {
+          SetLeaf(child, GetLabel(begin, mid));
+        }
+        if (end - mid > min_samples_split) {
+          next_level.push_back({ mid, end, child + 1, ChildPath(open.path, 1) });
+        } else {
+          SetLeaf(child + 1, GetLabel(mid, end));
+        }
+      }
+      level.swap(next_level);
+    }
+  }
+
+  // 一次为 level 中的所有结点搜索分裂：每个被选中的特征只扫描一遍 columns 中的一列，
+  // 每一项按 slot 所在的结点交给该结点在这个特征上的 SparseSweep。
+  // 已成为叶结点的样本不少于 columns 覆盖的一半时，先从 columns 中去掉它们
+  template <typename Criterion>
+  std::vector<BestSplitRes> FindLevelSplitsSparse(const std::vector<OpenNode> &level,
+    SparseColumns &columns, std::vector<int> &open_of_key) {
+    PROFILE_SCOPE("LevelSplits");
+    using Sweep = SparseSweep<Criterion>;
+    int open_count = 0;
+    for (int n = 0; n < level.size(); ++n) {
+      open_of_key[position_base + level[n].begin] = n;
+      open_count += level[n].end - level[n].begin;
+    }
+    if (open_count * 2 <= columns.slots_count) {
+      columns = columns.Filter([this, &open_of_key](int slot) {
+        return open_of_key[SlotNode(slot)] >= 0;
+      }, open_count, pool, parallel_cutoff);
+    }
+    // users[f] 为选中特征 f 的 (结点, 该特征在结点的 features 中的位置)
+    std::vector<std::vector<Sweep>> sweeps(level.size());
+    std::vector<std::vector<std::pair<int, int>>> users(features_count);
+    for (int n = 0; n < level.size(); ++n) {
+      auto &open = level[n];
+      sweeps[n].assign(open.features.size(),
+        Sweep(open.end - open.begin, CountLabel0(open.begin, open.end)));
+      for (int k = 0; k < open.features.size(); ++k) users[open.features[k]].push_back({ n, k });
+    }
+    // 各特征的 SparseSweep 互不相同，按特征并行
+    auto sweep_features = [this, &level, &columns, &open_of_key, &sweeps, &users](int first,
+      int last) {
+      // state[n] 为结点 n 在当前特征上的 SparseSweep，没有选中该特征时为空
+      std::vector<Sweep *> state(level.size(), nullptr);
+      for (int f = first; f < last; ++f) {
+        if (users[f].empty()) continue;
+        for (auto &user : users[f]) state[user.first] = &sweeps[user.first][user.second];
+        SweepColumn<Sweep>(columns, f, [this, &open_of_key, &state](int slot) {
+          int n = open_of_key[SlotNode(slot)];
+          return n < 0 ? nullptr : state[n];
+        });
+        for (auto &user : users[f]) state[user.first] = nullptr;
+      }
+    };
+    if (pool && open_count >= parallel_cutoff) {
+      pool->ParallelFor(0, features_count, 0, sweep_features);
+    } else {
+      sweep_features(0, features_count);
+    }
+    std::vector<BestSplitRes> res(level.size());
+    std::vector<FeatureSplit> splits;
+    for (int n = 0; n < level.size(); ++n) {
+      splits.clear();
+      for (auto &sweep : sweeps[n]) splits.push_back(sweep.Finish());
+      res[n] = MergeFeatureSplits(level[n].features, splits);
+      open_of_key[position_base + level[n].begin] = -1;
+    }
+    return res;
+  }
+
+  // 逐层建树时一批结点的直方图合计不超过这么多个计数
+  constexpr static size_t kLevelHistogramInts = size_t(1) << 22;
+
+  // 一次为 level 中的所有结点统计直方图并搜索分裂。每个结点只为自己选中的特征开一份
+  // 紧凑的直方图；按 indexes 的顺序扫描一遍各结点的样本，每个样本把它在结点所选各特征上
+  // 的桶号一起计入。结点多时按 kLevelHistogramInts 分批，各批的区间依次相接
+  template <typename Criterion>
+  std::vector<BestSplitRes> FindLevelSplitsHist(const std::vector<OpenNode> &level) {
+    PROFILE_SCOPE("LevelSplits");
+    auto &bins = matrix->bins;
+    auto labels = matrix->Labels();
+    std::vector<BestSplitRes> res(level.size());
+    // 结点 n 在本批 hist 中的起点，其中第 k 个特征的直方图再偏移 feature_offsets[n][k]
+    std::vector<size_t> hist_offsets(level.size());
+    std::vector<std::vector<int>> feature_offsets(level.size());
+    Histogram hist;
+    for (int first = 0, last; first < level.size(); first = last) {
+      size_t hist_size = 0;
+      int samples_count = 0;
+      for (last = first; last < level.size(); ++last) {
+        auto &open = level[last];
+        int node_size = 0;
+        for (auto f : open.features) {
+          feature_offsets[last].push_back(node_size);
+          node_size += bins.BinsCount(f) * 2;
+        }
+        if (last > first && hist_size + node_size > kLevelHistogramInts) {
+          feature_offsets[last].clear();
+          break;
+        }
+        hist_offsets[last] = hist_size;
+        hist_size += node_size;
+        samples_count += open.end - open.begin;
+      }
+      hist.assign(hist_size, 0);
+      auto search_nodes = [this, &level, &bins, labels, &res, &hist_offsets, &feature_offsets,
+        &hist](int node_first, int node_last) {
+        for (int n = node_first; n < node_last; ++n) {
+          auto &open = level[n];
+          auto &offsets = feature_offsets[n];
+          int *node_hist = hist.data() + hist_offsets[n];
+          auto count_features = [this, &open, &bins, labels, &offsets, node_hist](int k_first,
+            int k_last) {
+            std::vector<const FeatureBins::BinType *> bin_columns;
+            for (int k = k_first; k < k_last; ++k) {
+              bin_columns.push_back(bins.Column(open.features[k]));
+            }
+            for (int i = open.begin; i < open.end; ++i) {
+              auto sample = indexes[i];
+              int label = labels[sample];
+              for (int k = k_first; k < k_last; ++k) {
+                ++node_hist[offsets[k] + bin_columns[k - k_first][sample] * 2 + label];
+              }
+            }
+          };
+          // 样本多的结点 (靠近根的几层) 再按特征并行
+          if (pool && open.end - open.begin >= parallel_cutoff) {
+            pool->ParallelFor(0, open.features.size(), 0, count_features);
+          } else {
+            count_features(0, open.features.size());
+          }
+          int total_count = open.end - open.begin, total_0_count = 0;
+          int bins_count = bins.BinsCount(open.features[0]);
+          for (int b = 0; b < bins_count; ++b) total_0_count += node_hist[offsets[0] + b * 2];
+          long long evaluated = 0;
+          std::vector<FeatureSplit> splits(open.features.size());
+          for (int k = 0; k < open.features.size(); ++k) {
+            splits[k] = GetBestFeatureSplitHist<Criterion>(node_hist + offsets[k],
+              open.features[k], total_count, total_0_count, evaluated);
+          }
+          PROFILE_COUNT(kSplitsEvaluated, evaluated);
+          res[n] = MergeFeatureSplits(open.features, splits);
+        }
+      };
+      if (pool && samples_count >= parallel_cutoff) {
+        pool->ParallelFor(first, last, 1, search_nodes);
+      } else {
+        search_nodes(first, last);
+      }
     }
+    return res;
+  }
+
+  // 以 indexes 中 [begin, end) 的样本为全部样本、配置相同的一棵子树，根结点已分配
+  DecisionTree Fragment(int begin, int end) const {
+    DecisionTree sub(logger, id);
+    sub.features_count = features_count;
+    sub.max_features = max_features;
+    sub.max_depth = max_depth;
+    sub.min_samples_split = min_samples_split;
+    sub.split_mode = split_mode;
+    sub.grow_mode = grow_mode;
+    sub.parallel_cutoff = parallel_cutoff;
+    sub.seed = seed;
+    sub.pool = pool;
+    sub.matrix = matrix;
+    sub.indexes.assign(indexes.begin() + begin, indexes.begin() + end);
+    sub.slots.assign(slots.begin() + begin, slots.begin() + end);
+    sub.slot_node = slot_node;
+    sub.position_base = position_base + begin;
+    sub.AddNodes(1);
+    return sub;
   }
 
-  void AllocNewTree(int size) {
-    if (tree) delete[] tree;
-    else tree = new TreeNode[size];
-    for (int i = 0; i < size; ++i) tree[i].label = -2;
+  // 把 sub 接到 node_index 处：sub 的根写入 node_index，其余结点与叶子标签依次追加
+  void Splice(const DecisionTree &sub, int node_index) {
+    // sub 中下标 k (k >= 1) 的结点追加后位于 node_base + k
+    int node_base = nodes.size() - 1;
+    int leaf_base = leaf_labels.size();
+    auto moved = [node_base, leaf_base](TreeNode node) {
+      node.child += node.feature_index == kLeaf ? leaf_base : node_base;
+      return node;
+    };
+    nodes[node_index] = moved(sub.nodes[0]);
+    for (int k = 1; k < sub.nodes.size(); ++k) nodes.push_back(moved(sub.nodes[k]));
+    leaf_labels.insert(leaf_labels.end(), sub.leaf_labels.begin(), sub.leaf_labels.end());
   }
 
-  void BuildTree(const SamplePtrVec &samples) {
-    AllocNewTree(pow(2, max_depth));
-    BuildTreeRecursive(samples, 1, 1);
+  constexpr static uint64_t kRootPath = 1;
+  static uint64_t ChildPath(uint64_t path, int side) {
+    return Randomer::Mix(path * 2 + side);
   }
 
-  LabelType TestTree(const Sample &sample, int visiting_index = 1) {
-    auto &visiting = tree[visiting_index];
-    if (visiting.label == -2) return -2;
-    if (visiting.label == 0 || visiting.label == 1) {
-      return visiting.label;
+  // samples 会被移入 indexes 并在建树过程中被打乱，其中可以有重复的样本 (bootstrap)
+  // Criterion 为 split-criterion.h 中的分裂准则
+  template <typename Criterion>
+  void BuildTree(const FeatureMatrix &matrix, RowIndexVec samples) {
+    PROFILE_SCOPE("BuildTree");
+    this->matrix = &matrix;
+    indexes = std::move(samples);
+    slots.resize(indexes.size());
+    std::iota(slots.begin(), slots.end(), 0);
+    int size = indexes.size();
+    nodes.clear();
+    leaf_labels.clear();
+    int root = AddNodes(1);
+    if (split_mode == SplitMode::kHist && matrix.bins.Empty()) {
+      throw std::string("Histogram split needs FeatureMatrix::BuildBins");
     }
-    if (sample[visiting.feature_index] < visiting.feature_val) {
-      // left
-      return TestTree(sample, visiting_index * 2);
+    if (size == 0) {
+      SetLeaf(root, -2);
+    } else if (grow_mode == GrowMode::kLevelWise) {
+      BuildTreeLevelWise<Criterion>(size, root);
+    } else if (split_mode == SplitMode::kHist) {
+      BuildTreeRecursive<Criterion>(0, size, 1, root, kRootPath, BuildHistogram(0, size));
     } else {
-      // right
-      return TestTree(sample, visiting_index * 2 + 1);
+      auto columns = BuildSparseColumns();
+      BuildTreeRecursive<Criterion>(0, size, 1, root, kRootPath, Histogram(), &columns);
     }
+    nodes.shrink_to_fit();
+    leaf_labels.shrink_to_fit();
+    this->matrix = nullptr;
+    RowIndexVec().swap(indexes);
+    RowIndexVec().swap(slots);
+    slot_node.reset();
+  }
+
+  // Matrix 可以是 FeatureMatrix 或 CsrMatrix
+  template <typename Matrix>
+  LabelType TestTree(const Matrix &matrix, int row) const {
+    if (NodesCount() == 0) return -2;
+    auto nodes = Nodes();
+    int visiting = 0;
+    while (nodes[visiting].feature_index != kLeaf) {
+      auto &node = nodes[visiting];
+      // < 阈值走左侧 (child)，否则走右侧 (child + 1)
+      visiting = node.child + !(matrix.Get(row, node.feature_index) < node.feature_val);
+    }
+    return LeafLabels()[nodes[visiting].child];
+  }
+
+  // 与 TestTree 相同，但特征 feature 的值取自 donor 行 (用于置换重要性)
+  LabelType TestTreePermuted(const FeatureMatrix &matrix, int row, int feature,
+    int donor) const {
+    if (NodesCount() == 0) return -2;
+    auto nodes = Nodes();
+    int visiting = 0;
+    while (nodes[visiting].feature_index != kLeaf) {
+      auto &node = nodes[visiting];
+      int source = node.feature_index == feature ? donor : row;
+      visiting = node.child + !(matrix.Get(source, node.feature_index) < node.feature_val);
+    }
+    return LeafLabels()[nodes[visiting].child];
+  }
+
+  // 树中用于分裂的特征，升序且不重复
+  std::vector<int> UsedFeatures() const {
+    std::vector<int> features;
+    for (int i = 0; i < NodesCount(); ++i) {
+      if (Nodes()[i].feature_index != kLeaf) features.push_back(Nodes()[i].feature_index);
+    }
+    std::sort(features.begin(), features.end());
+    features.erase(std::unique(features.begin(), features.end()), features.end());
+    return features;
   }
 
   void PrintTree() {
-    int size = pow(2, max_depth);
-    int depth = 1;
-    for (int i = 1; i < size; ++i) {
-      auto &node = tree[i];
-      printf("(i: %d, v: %lf, l: %d)", node.feature_index, node.feature_val, node.label);
-      if (i == depth) {
-        printf("\n");
-        depth = depth * 2 + 1;
+    auto nodes = Nodes();
+    for (int i = 0; i < NodesCount(); ++i) {
+      auto &node = nodes[i];
+      if (node.feature_index == kLeaf) {
+        printf("%d: (l: %d)\n", i, LeafLabels()[node.child]);
+      } else {
+        printf("%d: (i: %d, v: %lf, c: %d)\n", i, node.feature_index, node.feature_val, node.child);
       }
     }
   }
 
-  void TryTree(int visiting_index = 1) {
-    auto &visiting = tree[visiting_index];
-    if (visiting.label == -2) printf("FAQ!\n");
-    if (visiting.label == 1 || visiting.label == 2) return;
-    if (visiting.label == -1) {
-      TryTree(visiting_index * 2);
-      TryTree(visiting_index * 2 + 1);
+  void TryTree(int visiting_index = 0) {
+    auto &visiting = Nodes()[visiting_index];
+    if (visiting.feature_index == kLeaf) {
+      if (LeafLabels()[visiting.child] == -2) printf("FAQ!\n");
+      return;
     }
+    TryTree(visiting.child);
+    TryTree(visiting.child + 1);
   }
 
   int max_features;
   int features_count;
   int max_depth;
   int min_samples_split;
+  SplitMode split_mode = SplitMode::kExact;
+  GrowMode grow_mode = GrowMode::kDepthFirst;
+  int parallel_cutoff = 2048;
   // int min_samples_leaf;
   // double min_impurity_split;
 
   Logger logger;
   int id;
-
-  std::function<double (const SamplePtrVec&)> CalcCoeff;
+  // 结点选取特征所用随机数流的种子
+  uint64_t seed = 0;
+  // 不为空时树内的工作也在该线程池上并行，仅在建树期间使用
+  ThreadPool *pool = nullptr;
+  // 仅在建树期间有效
+  const FeatureMatrix *matrix = nullptr;
+  // 可选，matrix 的 SparseColumns::FromMatrix，由 RandomForest 在建树期间设置
+  const SparseColumns *matrix_columns = nullptr;
+  // slots[i] 为 indexes[i] 在建树样本中的位置，划分时与 indexes 一起交换
+  RowIndexVec indexes, slots;
+  // 见 SlotNode，Fragment 与原树共用；position_base 为 indexes[0] 在原树 indexes 中的位置
+  std::shared_ptr<std::atomic<int>[]> slot_node;
+  int position_base = 0;
 };
 
-inline double CalcGini(const SamplePtrVec &samples) {
-  auto count = std::count_if(samples.begin(), samples.end(), [](const Sample *sample) -> bool {
-    return sample->label == 0;
-  });
-  auto p1 = count / double(samples.size());
-  auto p2 = (samples.size() - count) / double(samples.size());
-  return (p1 * (1.0 - p1)) + (p2 * (1.0 - p2));
-}
-
 #endif
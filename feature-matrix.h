@@ -0,0 +1,165 @@
+#ifndef FEATURE_MATRIX_H
+#define FEATURE_MATRIX_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstddef>
+#include "mapped-file.h"
+
+using LabelType = char;
+using FeatureVal = double;
+// 训练和预测都只通过行号访问矩阵
+using RowIndexVec = std::vector<int>;
+
+// 按行存储的稀疏矩阵 (CSR)，与 libsvm 输入格式一一对应
+struct CsrMatrix {
+  int rows_count = 0;
+  int features_count = 0;
+  // 第 i 行的非零元素位于 [row_offsets[i], row_offsets[i + 1])
+  std::vector<size_t> row_offsets = { 0 };
+  std::vector<int> feature_indexes;
+  std::vector<FeatureVal> values;
+  std::vector<LabelType> labels;
+
+  // 追加一行，各特征需已按 feature_index 升序 push 到 feature_indexes/values
+  void EndRow(LabelType label) {
+    labels.push_back(label);
+    row_offsets.push_back(values.size());
+    ++rows_count;
+  }
+
+  FeatureVal Get(int row, int feature_index) const {
+    auto begin = feature_indexes.begin() + row_offsets[row];
+    auto end = feature_indexes.begin() + row_offsets[row + 1];
+    auto it = std::lower_bound(begin, end, feature_index);
+    if (it == end || *it != feature_index) return 0.0;
+    return values[it - feature_indexes.begin()];
+  }
+
+  LabelType Label(int row) const { return labels[row]; }
+};
+
+// 每个特征按分位数量化成至多 kMaxBins 个桶，供直方图分裂使用
+// 桶号 bin(v) = 不大于 v 的切分点个数，因此 bin(v) < b 等价于 v < cuts[b - 1]
+struct FeatureBins {
+  constexpr static int kMaxBins = 256;
+  using BinType = unsigned char;
+
+  int rows_count = 0;
+  // 第 f 个特征的切分点，严格递增
+  std::vector<std::vector<FeatureVal>> cuts;
+  // 第 f 个特征的桶在直方图中的起始位置，bin_offsets[features_count] 为桶总数
+  std::vector<int> bin_offsets;
+  // column-major，同 FeatureMatrix
+  std::vector<BinType> bins;
+
+  bool Empty() const { return cuts.empty(); }
+  int BinsCount(int feature_index) const {
+    return bin_offsets[feature_index + 1] - bin_offsets[feature_index];
+  }
+  int TotalBinsCount() const { return bin_offsets.back(); }
+  const BinType *Column(int feature_index) const {
+    return bins.data() + size_t(feature_index) * rows_count;
+  }
+
+  static std::vector<FeatureVal> QuantileCuts(const FeatureVal *column, int rows_count,
+    int max_bins) {
+    std::vector<FeatureVal> sorted(column, column + rows_count);
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<FeatureVal> cuts;
+    if (sorted.empty()) return cuts;
+    auto distinct_end = std::unique(sorted.begin(), sorted.end());
+    int distinct_count = distinct_end - sorted.begin();
+    if (distinct_count <= max_bins) {
+      // 不同取值足够少时，每个取值单独一个桶
+      cuts.assign(sorted.begin() + 1, distinct_end);
+      return cuts;
+    }
+    // 否则在原始(含重复)的排序结果上取等距分位点
+    std::copy(column, column + rows_count, sorted.begin());
+    std::sort(sorted.begin(), sorted.end());
+    for (int i = 1; i < max_bins; ++i) {
+      auto cut = sorted[size_t(i) * rows_count / max_bins];
+      if (cut > sorted.front() && (cuts.empty() || cut > cuts.back())) cuts.push_back(cut);
+    }
+    return cuts;
+  }
+};
+
+// 按列连续存储的稠密矩阵，缺失的特征为 0.0
+struct FeatureMatrix {
+  int rows_count = 0;
+  int features_count = 0;
+  // column-major: 第 f 列位于 [f * rows_count, (f + 1) * rows_count)
+  std::vector<FeatureVal> values;
+  std::vector<LabelType> labels;
+  // 从数据缓存 mmap 加载的矩阵不持有 values/labels，直接指向映射的只读内存，
+  // mapped_file 随矩阵的各个副本保留到最后一个副本析构
+  std::shared_ptr<MappedFile> mapped_file;
+  const FeatureVal *mapped_values = nullptr;
+  const LabelType *mapped_labels = nullptr;
+  // 只有调用 BuildBins 之后才非空
+  FeatureBins bins;
+
+  FeatureMatrix() = default;
+  FeatureMatrix(int rows_count, int features_count)
+    : rows_count(rows_count), features_count(features_count),
+      values(size_t(rows_count) * features_count, 0.0), labels(rows_count, 0) {}
+
+  const FeatureVal *Values() const { return mapped_values ? mapped_values : values.data(); }
+  const LabelType *Labels() const { return mapped_values ? mapped_labels : labels.data(); }
+
+  const FeatureVal *Column(int feature_index) const {
+    return Values() + size_t(feature_index) * rows_count;
+  }
+
+  // 只用于填充自己持有 values 的矩阵
+  FeatureVal *MutableColumn(int feature_index) {
+    return values.data() + size_t(feature_index) * rows_count;
+  }
+
+  FeatureVal Get(int row, int feature_index) const {
+    return Column(feature_index)[row];
+  }
+
+  LabelType Label(int row) const { return Labels()[row]; }
+
+  void BuildBins(int max_bins = FeatureBins::kMaxBins) {
+    bins.rows_count = rows_count;
+    bins.cuts.resize(features_count);
+    bins.bin_offsets.assign(1, 0);
+    bins.bins.resize(size_t(rows_count) * features_count);
+    for (int f = 0; f < features_count; ++f) {
+      auto column = Column(f);
+      auto &cuts = bins.cuts[f];
+      cuts = FeatureBins::QuantileCuts(column, rows_count, max_bins);
+      bins.bin_offsets.push_back(bins.bin_offsets.back() + cuts.size() + 1);
+      auto bin_column = bins.bins.data() + size_t(f) * rows_count;
+      for (int row = 0; row < rows_count; ++row) {
+        bin_column[row] = std::upper_bound(cuts.begin(), cuts.end(), column[row]) - cuts.begin();
+      }
+    }
+  }
+
+  // 超出 features_count 的特征不会被任何树使用，直接丢弃
+  static FeatureMatrix FromCsr(const CsrMatrix &csr, int features_count) {
+    return FromCsr(csr, 0, csr.rows_count, features_count);
+  }
+
+  // 只转换 csr 的 [begin, end) 行
+  static FeatureMatrix FromCsr(const CsrMatrix &csr, int begin, int end, int features_count) {
+    FeatureMatrix matrix(end - begin, features_count);
+    for (int row = begin; row < end; ++row) {
+      for (size_t i = csr.row_offsets[row]; i < csr.row_offsets[row + 1]; ++i) {
+        int feature_index = csr.feature_indexes[i];
+        if (feature_index < 0 || feature_index >= features_count) continue;
+        matrix.MutableColumn(feature_index)[row - begin] = csr.values[i];
+      }
+    }
+    std::copy(csr.labels.begin() + begin, csr.labels.begin() + end, matrix.labels.begin());
+    return matrix;
+  }
+};
+
+#endif
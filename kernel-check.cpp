@@ -0,0 +1,141 @@
+// 用 `make kernel-check` 构建并运行：
+//   kernel-check.out data.txt [-rows 20000] [-features 201] [-density 0.15] [-seed 1]
+//     [-c 20] [-d 12] [-edge 0.02]
+// 在合成数据上训练一个小森林，再把一部分特征值改成恰好等于某个结点的阈值或 NaN，
+// 然后用 scalar/avx2/avx512 (当前 CPU 不支持的跳过) 遍历每一棵树，逐样本与
+// DecisionTree::TestTree 比较，并比较各内核下整个森林的投票。有任何不一致时返回非 0
+#include "random-forest.h"
+#include "data-reader.h"
+#include "synthetic-data.h"
+
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+
+// 每棵树上与 TestTree 结果不同的样本数
+int CheckTrees(TraversalKernel kernel, const RandomForest &rf, const FeatureMatrix &matrix) {
+  int mismatch_count = 0;
+  std::vector<LabelType> labels(matrix.rows_count);
+  for (int t = 0; t < rf.trees.size(); ++t) {
+    auto &tree = rf.trees[t];
+    // 起点和长度都不按 8/16 对齐，覆盖 SIMD 内核的尾部处理
+    for (int begin = 0; begin < matrix.rows_count; begin += RandomForest::kTestBlockSize - 3) {
+      int end = std::min(matrix.rows_count, begin + RandomForest::kTestBlockSize - 3);
+      TraverseTree(kernel, tree, matrix, begin, end, labels.data() + begin);
+    }
+    for (int i = 0; i < matrix.rows_count; ++i) {
+      auto expected = tree.TestTree(matrix, i);
+      if (labels[i] != expected) {
+        if (mismatch_count < 10) {
+          printf("%s: tree %d row %d gives %d, TestTree gives %d\n", TraversalKernelName(kernel),
+            t, i, labels[i], expected);
+        }
+        ++mismatch_count;
+      }
+    }
+  }
+  return mismatch_count;
+}
+
+int Run(int argc, char *args[]) {
+  if (argc < 2) {
+    printf("Use kernel-check data.txt [-rows 20000] [-features 201] [-density 0.15] [-seed 1]\n");
+    printf("    [-c 20] [-d 12] [-edge 0.02]\n");
+    return 1;
+  }
+  ArgsTable table = ParseArgs(argc, args, 2);
+  int rows_count = 20000;
+  int features_count = 201;
+  double density = 0.15;
+  int seed = 1;
+  int tree_count = 20;
+  int max_depth = 12;
+  // 每棵树把约这个比例的样本在它的某个分裂特征上改成阈值或 NaN
+  double edge = 0.02;
+  TableValToInt(table, "-rows", rows_count);
+  TableValToInt(table, "-features", features_count);
+  TableValToDouble(table, "-density", density);
+  TableValToInt(table, "-seed", seed);
+  TableValToInt(table, "-c", tree_count);
+  TableValToInt(table, "-d", max_depth);
+  TableValToDouble(table, "-edge", edge);
+
+  int ones_count = SyntheticData::Write(args[1], rows_count, features_count, density, seed);
+  // 两类严重失衡时森林对所有样本给出同一个标签，各内核的比较就没有意义了
+  if (!SyntheticData::Balanced(ones_count, rows_count)) {
+    printf("Synthetic data is unbalanced: %d of %d rows labelled 1\n", ones_count, rows_count);
+    return 1;
+  }
+  FeatureMatrix matrix;
+  {
+    MappedFile file(args[1]);
+    ThreadPool pool(1);
+    LibsvmParser::Parse(file.Data(), file.Size(), features_count, pool, matrix);
+  }
+
+  DecisionTreeInfo info;
+  info.max_depth = max_depth;
+  // 默认的 Gini 不按样本数加权，在这份数据上只切出两端很小的一段，整个森林对几乎所有
+  // 样本给出同一个标签；熵准则能学到有信息的特征，各内核的比较覆盖两种结果
+  info.criterion = SplitCriterion::kEntropy;
+  RandomForest rf(features_count, matrix, 0, info, tree_count,
+    std::min(rows_count, 10000), Logger(false));
+  rf.seed = seed;
+  rf.CalcTrees();
+
+  // 阈值处与 NaN 的比较方向最容易在 SIMD 内核中出错：
+  // TestTree 中 x == 阈值和 NaN 都走右侧
+  Randomer randomer(seed, 1);
+  int edge_count = 0;
+  for (auto &tree : rf.trees) {
+    auto nodes = tree.Nodes();
+    for (int n = 0; n < tree.NodesCount(); ++n) {
+      if (nodes[n].feature_index == DecisionTree::kLeaf) continue;
+      auto column = matrix.MutableColumn(nodes[n].feature_index);
+      for (int i = 0; i < matrix.rows_count; ++i) {
+        if (randomer.RandDouble() >= edge / tree.NodesCount()) continue;
+        column[i] = randomer.RandDouble() < 0.8 ? nodes[n].feature_val : NAN;
+        ++edge_count;
+      }
+    }
+  }
+  printf("%lu trees, %d rows, %d values set to thresholds or NaN\n", rf.trees.size(),
+    matrix.rows_count, edge_count);
+
+  int failed = 0;
+  std::vector<std::pair<int, int>> scalar_votes;
+  for (auto kernel : { TraversalKernel::kScalar, TraversalKernel::kAvx2,
+    TraversalKernel::kAvx512 }) {
+    if (!TraversalKernelSupported(kernel)) {
+      printf("%s: not supported by this CPU, skipped\n", TraversalKernelName(kernel));
+      continue;
+    }
+    int mismatch_count = CheckTrees(kernel, rf, matrix);
+    rf.kernel = kernel;
+    rf.Test();
+    int vote_mismatch_count = 0;
+    if (kernel == TraversalKernel::kScalar) {
+      scalar_votes = rf.decision_res;
+      int majority_0_count = 0;
+      for (auto &votes : scalar_votes) majority_0_count += votes.first > votes.second;
+      printf("scalar: forest votes 0 for %d of %d rows\n", majority_0_count, matrix.rows_count);
+      if (majority_0_count == 0 || majority_0_count == matrix.rows_count) {
+        printf("The forest gives every row the same label\n");
+        ++failed;
+      }
+    } else {
+      for (int i = 0; i < matrix.rows_count; ++i) {
+        vote_mismatch_count += rf.decision_res[i] != scalar_votes[i];
+      }
+    }
+    printf("%s: %d tree results and %d forest votes differ\n", TraversalKernelName(kernel),
+      mismatch_count, vote_mismatch_count);
+    failed += mismatch_count + vote_mismatch_count;
+  }
+  return failed > 0;
+}
+
+int main(int argc, char *args[]) {
+  return RunMain(argc, args, Run);
+}
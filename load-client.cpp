@@ -0,0 +1,182 @@
+// rf serve 的压测客户端，用 `make load-client` 构建：
+//   load-client.out rf.sock data.txt [-c 8] [-n 100000] [-window 1]
+// 开 c 个连接，依次循环发送 data.txt 中的行，共 n 个请求。每个连接最多有 window 个请求
+// 在等待回复 (window 为 1 时即发一条、等一条)。结束后输出客户端测得的吞吐量和延迟分位数，
+// 以及服务端 stats 命令的回复
+#include "util.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int Connect(const std::string &path) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw std::string("Socket path too long: ") + path;
+  }
+  strcpy(addr.sun_path, path.c_str());
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    if (fd >= 0) close(fd);
+    throw std::string("Cannot connect to ") + path + ": " + strerror(errno);
+  }
+  return fd;
+}
+
+void SendAll(int fd, const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) throw std::string("Connection closed by the server");
+    sent += n;
+  }
+}
+
+// 按行读取回复
+struct LineReader {
+  explicit LineReader(int fd) : fd(fd) {}
+
+  std::string ReadLine() {
+    while (true) {
+      auto newline = pending.find('\n');
+      if (newline != std::string::npos) {
+        auto line = pending.substr(0, newline);
+        pending.erase(0, newline + 1);
+        return line;
+      }
+      char buffer[4096];
+      ssize_t n = read(fd, buffer, sizeof(buffer));
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) throw std::string("Connection closed by the server");
+      pending.append(buffer, n);
+    }
+  }
+
+  int fd;
+  std::string pending;
+};
+
+struct ClientResult {
+  std::vector<double> latencies_us;
+  long long errors = 0;
+  std::string failure;
+};
+
+void RunClient(const std::string &path, const std::vector<std::string> &lines, int first,
+  int step, int requests, int window, ClientResult &result) {
+  try {
+    int fd = Connect(path);
+    LineReader reader(fd);
+    std::deque<high_clock::time_point> in_flight;
+    int sent = 0, received = 0;
+    while (received < requests) {
+      std::string batch;
+      while (sent < requests && in_flight.size() < window) {
+        batch += lines[(first + size_t(sent) * step) % lines.size()];
+        batch += '\n';
+        in_flight.push_back(high_clock::now());
+        ++sent;
+      }
+      if (!batch.empty()) SendAll(fd, batch);
+      auto reply = reader.ReadLine();
+      auto us = duration_cast<duration<double, std::micro>>(
+        high_clock::now() - in_flight.front()).count();
+      in_flight.pop_front();
+      result.latencies_us.push_back(us);
+      if (reply.compare(0, 5, "error") == 0) ++result.errors;
+      ++received;
+    }
+    close(fd);
+  } catch (const std::string &e) {
+    result.failure = e;
+  }
+}
+
+int Run(int argc, char *args[]) {
+  if (argc <= 2) {
+    printf("Use load-client rf.sock data.txt [-c 8] [-n 100000] [-window 1]\n");
+    return 1;
+  }
+  std::string path = args[1];
+  ArgsTable table = ParseArgs(argc, args, 3);
+  int clients_count = 8;
+  int requests = 100000;
+  int window = 1;
+  TableValToInt(table, "-c", clients_count);
+  TableValToInt(table, "-n", requests);
+  TableValToInt(table, "-window", window);
+  clients_count = std::max(clients_count, 1);
+  window = std::max(window, 1);
+
+  std::vector<std::string> lines;
+  {
+    std::ifstream ifs(args[2]);
+    if (!ifs.is_open()) {
+      printf("File not opened: %s\n", args[2]);
+      return 1;
+    }
+    std::string line;
+    while (std::getline(ifs, line)) {
+      if (!line.empty()) lines.push_back(line);
+    }
+  }
+  if (lines.empty()) {
+    printf("No requests in %s\n", args[2]);
+    return 1;
+  }
+
+  std::vector<ClientResult> results(clients_count);
+  std::vector<std::thread> threads;
+  auto start = high_clock::now();
+  for (int c = 0; c < clients_count; ++c) {
+    // 请求在各连接间平均分配，第 c 个连接发送第 c, c + clients_count, ... 行
+    int count = requests / clients_count + (c < requests % clients_count);
+    threads.emplace_back(RunClient, path, std::cref(lines), c, clients_count, count, window,
+      std::ref(results[c]));
+  }
+  for (auto &thread : threads) thread.join();
+  double seconds = duration_cast<duration<double>>(high_clock::now() - start).count();
+
+  std::vector<double> latencies;
+  long long errors = 0;
+  for (auto &result : results) {
+    if (!result.failure.empty()) {
+      printf("Client failed: %s\n", result.failure.c_str());
+      return 1;
+    }
+    latencies.insert(latencies.end(), result.latencies_us.begin(), result.latencies_us.end());
+    errors += result.errors;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double q) {
+    return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1,
+      size_t(q * latencies.size()))];
+  };
+  printf("%lu requests from %d connections (window %d) in %lf s: %.1lf requests/s, "
+    "%lld errors\n", latencies.size(), clients_count, window, seconds,
+    latencies.size() / seconds, errors);
+  printf("client latency us: p50 %.1lf p90 %.1lf p99 %.1lf max %.1lf\n", percentile(0.5),
+    percentile(0.9), percentile(0.99), latencies.empty() ? 0.0 : latencies.back());
+
+  int fd = Connect(path);
+  SendAll(fd, "stats\n");
+  LineReader reader(fd);
+  printf("server: %s\n", reader.ReadLine().c_str());
+  close(fd);
+  return 0;
+}
+
+int main(int argc, char *args[]) {
+  return RunMain(argc, args, Run);
+}
@@ -1,66 +1,85 @@
 #include "random-forest.h"
 #include "data-reader.h"
+#include "stream-scorer.h"
+#include "model-codegen.h"
+#include "prediction-server.h"
 
 #include <cstdio>
 #include <string>
-#include <unordered_map>
 #include <signal.h>
-
-using ArgsTable = std::unordered_map<std::string, std::string>;
-
-void TableValToInt(const ArgsTable &table, const std::string &key, int &val) {
-  if (table.count(key) > 0) {
-    sscanf(table.at(key).c_str(), "%d", &val);
-  }
-}
+#include <unistd.h>
 
 void ShowHint() {
   printf("Use rf train|test train_data|test_data\n");
+  printf("    rf score test_data|- [-o test_res.csv|-] [-stream 1] [-chunk-mb 4]\n");
+  printf("    rf test|score ... [-kernel scalar|avx2|avx512]\n");
+  printf("    rf test|score ... [-early-exit 1] [-confidence 0.99] [-reorder 1]\n");
+  printf("    rf train train_data [-seed n] [-bootstrap 1] [-sample-size 1000]\n");
+  printf("        [-split exact|hist] [-grow depth|level] [-oob 1] [-importance 1] ...\n");
+  printf("        [-warm-start tree.bin] [-checkpoint-every k]\n");
+  printf("        [-criterion gini|entropy|misclass]\n");
+  printf("    rf export-cpp tree.bin [-o rf-model-gen.h]\n");
+  printf("    rf serve rf.sock|- [-max-batch 64] [-max-wait-us 500]\n");
+  printf("    rf ... [-trace trace.json] (built with make PROFILE=1)\n");
+  printf("    rf ... [-v 0|1] [-log-level debug|info] [-log rf.log]\n");
 }
 
+// 以 make PROFILE=1 构建时，main 返回前打印性能统计，给出 -trace 时另写 trace 文件
+struct ProfileReport {
+  ~ProfileReport() {
+    if (!PROFILE_ENABLED) return;
+    Profiler::Instance().Report();
+    if (!trace_file.empty() && !Profiler::Instance().WriteTrace(trace_file)) {
+      printf("Cannot write trace %s\n", trace_file.c_str());
+    }
+  }
+
+  std::string trace_file;
+};
+
+constexpr int kFeaturesCount = 201;
 constexpr char kTreeBinFile[] = "tree.bin";
 constexpr char kTestResFile[] = "test_res.csv";
+// -reorder 用前这么多个样本的投票给树排序
+constexpr int kReorderSamples = 2048;
 
 RandomForest *p_rf = nullptr;
+PredictionServer *p_server = nullptr;
+volatile sig_atomic_t signal_count = 0;
 
-void SaveAll() {
-  if (!p_rf) {
-    printf("No RandomForest instance yet..");
-  } else {
-    printf("Saving all the things...");
-    p_rf->SaveTest(kTestResFile);
-    p_rf->SaveTreesToFile(kTreeBinFile);
-  }
-}
-
+// 训练时第一次 SIGINT/SIGTERM 只请求停止：正在建的树完成后照常保存已完成的树，
+// 之后可以 -warm-start 继续；rf serve 则停止接受连接，回复完已读入的请求后退出。
+// 再次收到信号时限时写出队列中的日志，再按默认方式退出。
+// 信号处理函数中只做 async-signal-safe 的操作
 void HandleSignal(int sig) {
-  if (sig == SIGINT) {
-    SaveAll();
-    printf("Saving done!\nUse `kill -30` to kill this process\n");
-  } else if (sig == 30) {
-    SaveAll();
-    exit(1);
+  if (signal_count++ > 0) {
+    Logger::Flush(std::chrono::milliseconds(500));
+    signal(sig, SIG_DFL);
+    raise(sig);
+    return;
   }
+  if (p_rf) p_rf->stop_requested.store(true);
+  if (p_server) p_server->stop_requested.store(true);
+  const char message[] = "\nStopping after the work in progress, signal again to abort\n";
+  ssize_t ignored = write(STDERR_FILENO, message, sizeof(message) - 1);
+  (void)ignored;
 }
 
-int main(int argc, char *args[]) {
+int Run(int argc, char *args[]) {
   if (argc <= 2) {
     ShowHint();
     return 1;
   }
 
-  signal(SIGINT, HandleSignal);
-  signal(30, HandleSignal);
+  ArgsTable table = ParseArgs(argc, args, 3);
 
-  ArgsTable table;
-
-  std::string first, second;
-  for (int i = 3; i < argc; ++i) {
-    if (i % 2 == 1) {
-      first = args[i];
+  ProfileReport profile_report;
+  TableValToString(table, "-trace", profile_report.trace_file);
+  if (!profile_report.trace_file.empty()) {
+    if (PROFILE_ENABLED) {
+      Profiler::Instance().EnableTrace();
     } else {
-      second = args[i];
-      table[first] = second;
+      printf("-trace needs a build with `make PROFILE=1`\n");
     }
   }
 
@@ -72,14 +91,126 @@ int main(int argc, char *args[]) {
   std::string arg1 = args[1];
   std::string arg2 = args[2];
 
-  DataReader reader(arg2);
+  // exact|hist
+  std::string split = "exact";
+  TableValToString(table, "-split", split);
+  bool use_hist = split == "hist";
+  // depth|level
+  std::string grow = "depth";
+  TableValToString(table, "-grow", grow);
+
   int threading = -1;
   TableValToInt(table, "-p", threading);
 
+  // 0 to always parse the text and skip the binary cache
+  int use_cache = 1;
+  TableValToInt(table, "-cache", use_cache);
+
   int verbose = 1;
   TableValToInt(table, "-v", verbose);
 
-  Logger logger(verbose, false);
+  // debug|info
+  std::string log_level = "debug";
+  TableValToString(table, "-log-level", log_level);
+  // also append the log to this file
+  std::string log_file;
+  TableValToString(table, "-log", log_file);
+
+  std::string output = kTestResFile;
+  TableValToString(table, "-o", output);
+
+  // 打分结果写到 stdout 时日志不能写到屏幕上 (同 serve -)，仍可以写到 -log 文件
+  bool result_to_stdout = (arg1 == "test" || arg1 == "score") && output == "-";
+  Logger logger(verbose && !result_to_stdout, !log_file.empty(), log_file,
+    log_level == "info" ? LogLevel::kInfo : LogLevel::kDebug);
+
+  int stream = 1;
+  TableValToInt(table, "-stream", stream);
+
+  // scalar|avx2|avx512, 默认按 CPU 自动选择
+  std::string kernel_name;
+  TableValToString(table, "-kernel", kernel_name);
+  auto kernel = ParseTraversalKernel(kernel_name);
+  // 1 to stop voting once the hard label is decided
+  int early_exit = 0;
+  TableValToInt(table, "-early-exit", early_exit);
+  // with -early-exit, also stop when the majority holds at this confidence
+  double confidence = 0.0;
+  TableValToDouble(table, "-confidence", confidence);
+  // 1 to run the trees that agree most with the forest first
+  int reorder = 0;
+  TableValToInt(table, "-reorder", reorder);
+
+  if (arg1 == "score" && stream) {
+    // 流式打分不读入整个数据集，"-" 表示 stdin/stdout
+    int chunk_mb = 4;
+    TableValToInt(table, "-chunk-mb", chunk_mb);
+    FeatureMatrix no_samples;
+    RandomForest rf(kFeaturesCount, no_samples, threading, DecisionTreeInfo(), 100, 1000, logger);
+    rf.kernel = kernel;
+    rf.early_exit = early_exit;
+    rf.early_exit_confidence = confidence;
+    rf.LoadTreesFromFile(kTreeBinFile);
+    if (reorder) logger.Info("-reorder needs the samples in memory, use -stream 0");
+    FILE *in = arg2 == "-" ? stdin : fopen(arg2.c_str(), "rb");
+    FILE *out = output == "-" ? stdout : fopen(output.c_str(), "wb");
+    if (!in || !out) {
+      throw std::string("File not opened");
+    }
+    ThreadPool pool(ThreadCount(threading));
+    StreamScorer scorer(rf, pool, size_t(std::max(chunk_mb, 1)) << 20, logger);
+    scorer.Run(in, out);
+    if (in != stdin) fclose(in);
+    if (out != stdout) fclose(out);
+    return 0;
+  }
+
+  if (arg1 == "serve") {
+    // 这里 arg2 是 socket 的路径，"-" 表示 stdin/stdout
+    int max_batch = 64;
+    TableValToInt(table, "-max-batch", max_batch);
+    int max_wait_us = 500;
+    TableValToInt(table, "-max-wait-us", max_wait_us);
+    // stdout 用于回复时日志不能写到屏幕上
+    Logger serve_logger = arg2 == "-"
+      ? Logger(false, !log_file.empty(), log_file, LogLevel::kInfo) : logger;
+    FeatureMatrix no_samples;
+    RandomForest rf(kFeaturesCount, no_samples, threading, DecisionTreeInfo(), 100, 1000,
+      serve_logger);
+    rf.kernel = kernel;
+    rf.early_exit = early_exit;
+    rf.early_exit_confidence = confidence;
+    rf.LoadTreesFromFile(kTreeBinFile);
+    ThreadPool pool(ThreadCount(threading));
+    PredictionServer server(rf, pool, max_batch, std::chrono::microseconds(max_wait_us),
+      serve_logger);
+    if (arg2 == "-") {
+      server.ServeStream(STDIN_FILENO, STDOUT_FILENO);
+    } else {
+      p_server = &server;
+      signal(SIGINT, HandleSignal);
+      signal(SIGTERM, HandleSignal);
+      server.ServeSocket(arg2);
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      p_server = nullptr;
+    }
+    return 0;
+  }
+
+  if (arg1 == "export-cpp") {
+    // 这里 arg2 是模型文件
+    std::string code_file = "rf-model-gen.h";
+    TableValToString(table, "-o", code_file);
+    FeatureMatrix no_samples;
+    RandomForest rf(kFeaturesCount, no_samples, 0, DecisionTreeInfo(), 100, 1000, logger);
+    rf.LoadTreesFromFile(arg2, true);
+    ModelCodegen::Export(rf, arg2, code_file);
+    logger.Info("Exported %lu trees to %s", rf.trees.size(), code_file.c_str());
+    return 0;
+  }
+
+  DataReader reader(arg2, kFeaturesCount, arg1 == "train" && use_hist, threading, use_cache);
 
   if (arg1 == "train") {
     // TreeInfo
@@ -91,24 +222,66 @@ int main(int argc, char *args[]) {
     TableValToInt(table, "-min-split", min_samples_split);
     TableValToInt(table, "-c", tree_count);
     TableValToInt(table, "-sample-size", one_sample_size);
+    // 1 to sample each tree's rows with replacement
+    int bootstrap = 0;
+    TableValToInt(table, "-bootstrap", bootstrap);
+    // 1 to estimate accuracy on each tree's out-of-bag rows while training
+    int oob = 0;
+    TableValToInt(table, "-oob", oob);
+    // 1 to also compute permutation importance (implies -oob 1)
+    int importance = 0;
+    TableValToInt(table, "-importance", importance);
+    // grow -c more trees after the ones in this model
+    std::string warm_start;
+    TableValToString(table, "-warm-start", warm_start);
 
     DecisionTreeInfo info;
+    // nodes with at least this many samples are split in parallel
+    TableValToInt(table, "-parallel-cutoff", info.parallel_cutoff);
     info.max_depth = max_depth;
     info.min_samples_split = min_samples_split;
-    RandomForest rf(201, reader.samples, threading, info, tree_count, one_sample_size, logger);
-    p_rf = &rf;
+    info.split_mode = use_hist ? DecisionTree::SplitMode::kHist : DecisionTree::SplitMode::kExact;
+    info.grow_mode = grow == "level"
+      ? DecisionTree::GrowMode::kLevelWise : DecisionTree::GrowMode::kDepthFirst;
+    // gini|entropy|misclass
+    std::string criterion = "gini";
+    TableValToString(table, "-criterion", criterion);
+    info.criterion = ParseSplitCriterion(criterion);
+    RandomForest rf(kFeaturesCount, reader.matrix, threading, info, tree_count, one_sample_size, logger);
+    TableValToUint64(table, "-seed", rf.seed);
+    rf.bootstrap = bootstrap;
+    rf.oob = oob;
+    rf.importance = importance;
+    TableValToString(table, "-importance-file", rf.importance_file);
+    // save tree.bin every k new trees
+    TableValToInt(table, "-checkpoint-every", rf.checkpoint_every);
+    rf.checkpoint_file = kTreeBinFile;
+    if (!warm_start.empty()) rf.WarmStart(warm_start);
 
-    rf.CalcTrees();
-    rf.SaveTreesToFile("tree.bin");
-  } else if (arg1 == "test") {
-    RandomForest rf(201, reader.samples, threading, DecisionTreeInfo(), 100, 1000, logger);
     p_rf = &rf;
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+    size_t expected_count = rf.trees.size() + tree_count;
+    rf.CalcTrees();
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    p_rf = nullptr;
+    rf.SaveTreesToFile(kTreeBinFile);
+    if (rf.trees.size() < expected_count) {
+      logger.Info("Continue with `-warm-start %s -c %lu`", kTreeBinFile,
+        expected_count - rf.trees.size());
+    }
+  } else if (arg1 == "test" || arg1 == "score") {
+    RandomForest rf(kFeaturesCount, reader.matrix, threading, DecisionTreeInfo(), 100, 1000, logger);
+    rf.kernel = kernel;
+    rf.early_exit = early_exit;
+    rf.early_exit_confidence = confidence;
     rf.LoadTreesFromFile("tree.bin");
-    rf.TestAndSave("test_res.csv");
+    if (reorder) rf.ReorderTrees(reader.matrix, kReorderSamples);
+    rf.TestAndSave(output);
   } else if (arg1 == "print") {
-    RandomForest rf(201, reader.samples, threading, DecisionTreeInfo(), 100, 1000, logger);
-    p_rf = &rf;
-    rf.LoadTreesFromFile("tree.bin");
+    RandomForest rf(kFeaturesCount, reader.matrix, threading, DecisionTreeInfo(), 100, 1000, logger);
+    rf.LoadTreesFromFile("tree.bin", true);
     auto &trees = rf.trees;
     for (auto &tree : trees) {
       tree.TryTree();
@@ -119,3 +292,7 @@ int main(int argc, char *args[]) {
 
   return 0;
 }
+
+int main(int argc, char *args[]) {
+  return RunMain(argc, args, Run);
+}
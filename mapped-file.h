@@ -0,0 +1,57 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// 只读地映射整个文件，析构时解除映射。多个进程映射同一文件时共享页缓存
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string &filename) {
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::string("File not opened: ") + filename;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      throw std::string("Cannot stat file: ") + filename;
+    }
+    size = st.st_size;
+    if (size > 0) {
+      void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (addr == MAP_FAILED) {
+        close(fd);
+        throw std::string("Cannot mmap file: ") + filename;
+      }
+      data = static_cast<const char*>(addr);
+    }
+  }
+
+  ~MappedFile() {
+    if (data) munmap(const_cast<char*>(data), size);
+    if (fd >= 0) close(fd);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile &operator=(const MappedFile&) = delete;
+
+  const char *Data() const { return data; }
+  size_t Size() const { return size; }
+
+  // 顺序读取时提示内核预读
+  void AdviseSequential() const {
+    if (data) madvise(const_cast<char*>(data), size, MADV_SEQUENTIAL);
+  }
+
+ private:
+  int fd = -1;
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef MODEL_CODEGEN_H
+#define MODEL_CODEGEN_H
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include "random-forest.h"
+
+// 把训练好的森林导出为只有分支的 C++ 头文件：每棵树是一个函数，阈值与特征下标都是
+// 字面常量，另有一个对所有树投票的 Vote。阈值以十六进制浮点输出，与 tree.bin 中逐位相同；
+// 比较同样是 x < v 走左侧、否则 (含 NaN) 走右侧，因此预测与解释执行完全一致。
+// 生成的代码只依赖标准库，接口放在 namespace rf_model 中：
+//   int Tree<i>(const double *x);            // 0/1，空树为 -2
+//   void Vote(const double *x, int votes[2]); // votes 累加 label 0/1 的票数
+// x 为长度 kFeaturesCount 的稠密特征向量
+struct ModelCodegen {
+  static void Export(const RandomForest &forest, const std::string &source,
+    const std::string &filename) {
+    std::ofstream ofs(filename);
+    if (!ofs.is_open()) {
+      throw std::string("File not opened");
+    }
+    ofs << "// Generated by `rf export-cpp " << source << "`, do not edit.\n"
+        << "#ifndef RF_MODEL_GEN_H\n"
+        << "#define RF_MODEL_GEN_H\n\n"
+        << "#include <limits>\n\n"
+        << "namespace rf_model {\n\n"
+        << "constexpr int kFeaturesCount = " << forest.features_count << ";\n"
+        << "constexpr int kTreeCount = " << forest.trees.size() << ";\n";
+    for (int i = 0; i < forest.trees.size(); ++i) {
+      auto &tree = forest.trees[i];
+      ofs << "\ninline int Tree" << i << "(const double *x) {\n";
+      if (tree.NodesCount() == 0) {
+        ofs << "  return -2;\n";
+      } else {
+        EmitNode(ofs, tree, 0, 1);
+      }
+      ofs << "}\n";
+    }
+    ofs << "\ninline void Vote(const double *x, int votes[2]) {\n"
+        << "  int label;\n";
+    for (int i = 0; i < forest.trees.size(); ++i) {
+      ofs << "  label = Tree" << i << "(x);\n"
+          << "  if (label >= 0) ++votes[label];\n";
+    }
+    ofs << "}\n\n"
+        << "}  // namespace rf_model\n\n"
+        << "#endif\n";
+    if (!ofs) {
+      throw std::string("Something wrong in writing ") + filename;
+    }
+  }
+
+ private:
+  static std::string Literal(double val) {
+    if (std::isinf(val)) {
+      return val > 0 ? "std::numeric_limits<double>::infinity()"
+                     : "-std::numeric_limits<double>::infinity()";
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%a", val);
+    return buffer;
+  }
+
+  static void EmitNode(std::ofstream &ofs, const DecisionTree &tree, int index, int depth) {
+    std::string indent(depth * 2, ' ');
+    auto &node = tree.Nodes()[index];
+    if (node.feature_index == DecisionTree::kLeaf) {
+      ofs << indent << "return " << int(tree.LeafLabels()[node.child]) << ";\n";
+      return;
+    }
+    // x < NaN 恒为假，只会走右侧
+    if (std::isnan(node.feature_val)) {
+      EmitNode(ofs, tree, node.child + 1, depth);
+      return;
+    }
+    ofs << indent << "if (x[" << node.feature_index << "] < " << Literal(node.feature_val)
+        << ") {\n";
+    EmitNode(ofs, tree, node.child, depth + 1);
+    ofs << indent << "} else {\n";
+    EmitNode(ofs, tree, node.child + 1, depth + 1);
+    ofs << indent << "}\n";
+  }
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef MODEL_FILE_H
+#define MODEL_FILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include "util.h"
+
+// tree.bin 的布局:
+//   ModelFileHeader
+//   ModelTreeEntry * tree_count
+//   (补齐到 kModelSectionAlign)
+//   nodes:       DecisionTree::TreeNode * nodes_count，所有树依次拼接
+//   leaf_labels: LabelType * leaves_count
+// 文件被 mmap 后各个树直接在映射内存上遍历，不做任何复制
+constexpr char kModelMagic[8] = { 'R', 'F', 'M', 'O', 'D', 'E', 'L', '\0' };
+constexpr uint32_t kModelVersion = 1;
+constexpr size_t kModelSectionAlign = 64;
+
+struct ModelFileHeader {
+  char magic[8];
+  uint32_t version;
+  // sizeof(TreeNode)，不同平台/编译器布局不一致时拒绝加载
+  uint32_t node_size;
+  uint32_t features_count;
+  uint32_t max_depth;
+  uint32_t tree_count;
+  uint32_t reserved;
+  uint64_t nodes_count;
+  uint64_t leaves_count;
+  uint64_t nodes_offset;
+  uint64_t leaves_offset;
+  // 文件头之后所有字节的 FNV-1a
+  uint64_t checksum;
+};
+
+struct ModelTreeEntry {
+  // 在 nodes / leaf_labels 段中的起始下标
+  uint64_t first_node;
+  uint64_t first_leaf;
+  uint32_t nodes_count;
+  uint32_t leaves_count;
+};
+
+#endif
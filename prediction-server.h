@@ -0,0 +1,344 @@
+#ifndef PREDICTION_SERVER_H
+#define PREDICTION_SERVER_H
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "random-forest.h"
+#include "data-reader.h"
+#include "thread-pool.h"
+
+// 常驻的打分服务：模型只加载一次，从 stdin 或 Unix domain socket 逐行读入 libsvm 格式的样本
+// (标签可以省略)，每行回复一行 "label fraction"，fraction 为投给该标签的树所占的比例；
+// 格式错误的行回复 "error ..."。一行 "stats" 回复请求数、批数、启动以来的平均吞吐量，
+// 以及最近请求从读入到回复就绪的延迟 p50/p99 (微秒)。
+// 所有连接的请求汇入同一个队列，由批处理线程攒成微批：凑够 max_batch 条，或者批中第一条
+// 已等待 max_wait 后，在线程池上一起打分。同一连接的回复顺序与请求顺序一致
+class PredictionServer {
+ public:
+  constexpr static size_t kReadSize = 64 << 10;
+  // 超过这个长度还没有换行时断开连接
+  constexpr static size_t kMaxLineSize = 1 << 20;
+  // 延迟统计只保留最近的这么多个请求
+  constexpr static size_t kLatencyWindow = 1 << 16;
+
+  PredictionServer(const RandomForest &forest, ThreadPool &pool, int max_batch,
+    std::chrono::microseconds max_wait, const Logger &logger = Logger())
+    : forest(forest), pool(pool), max_batch(std::max(max_batch, 1)), max_wait(max_wait),
+      queue(size_t(this->max_batch) * 4), logger(logger), start(high_clock::now()) {}
+
+  // 从 in_fd 读请求、向 out_fd 写回复，直到 in_fd 结束且所有请求都已回复
+  void ServeStream(int in_fd, int out_fd) {
+    auto conn = std::make_shared<Connection>(in_fd, out_fd, false);
+    std::thread batcher([this]() { BatchLoop(); });
+    ReadRequests(conn);
+    queue.Close();
+    batcher.join();
+    LogSummary();
+  }
+
+  // 在 path 上监听，直到 stop_requested 被置为 true
+  void ServeSocket(const std::string &path) {
+    int listen_fd = Listen(path);
+    logger.Info("Serving on %s (max batch %d, max wait %lld us)", path.c_str(), max_batch,
+      (long long)max_wait.count());
+    std::thread batcher([this]() { BatchLoop(); });
+    struct Client {
+      std::shared_ptr<Connection> conn;
+      std::thread reader;
+    };
+    std::vector<Client> clients;
+    while (!stop_requested) {
+      pollfd pfd = { listen_fd, POLLIN, 0 };
+      // 定期醒来检查 stop_requested
+      if (poll(&pfd, 1, 200) <= 0) continue;
+      int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) continue;
+      auto conn = std::make_shared<Connection>(fd, fd, true);
+      clients.push_back({ conn, std::thread([this, conn]() { ReadRequests(conn); }) });
+      // 回收已经断开的连接的线程
+      for (auto it = clients.begin(); it != clients.end();) {
+        if (it->conn->reader_done) {
+          it->reader.join();
+          it = clients.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+    close(listen_fd);
+    unlink(path.c_str());
+    // 让阻塞在 read 上的线程返回，已经读入的请求仍会被回复
+    for (auto &client : clients) shutdown(client.conn->in_fd, SHUT_RD);
+    for (auto &client : clients) client.reader.join();
+    queue.Close();
+    batcher.join();
+    LogSummary();
+  }
+
+  // 可在信号处理函数中设置
+  std::atomic<bool> stop_requested{false};
+
+ private:
+  struct Connection {
+    Connection(int in_fd, int out_fd, bool is_socket)
+      : in_fd(in_fd), out_fd(out_fd), is_socket(is_socket) {}
+    ~Connection() {
+      if (is_socket) close(in_fd);
+    }
+
+    // socket 时 in_fd == out_fd，由 Connection 关闭
+    int in_fd, out_fd;
+    bool is_socket;
+    // 写失败 (对端已断开) 后不再写，只由批处理线程访问
+    bool broken = false;
+    std::atomic<bool> reader_done{false};
+  };
+
+  struct Request {
+    bool is_stats = false;
+    std::string text;
+    std::shared_ptr<Connection> conn;
+    high_clock::time_point arrival;
+  };
+
+  int Listen(const std::string &path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+      throw std::string("Socket path too long: ") + path;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    // 只删除上次运行留下的 socket，不会删掉同名的普通文件
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+      || listen(fd, 128) != 0) {
+      if (fd >= 0) close(fd);
+      throw std::string("Cannot listen on ") + path + ": " + strerror(errno);
+    }
+    return fd;
+  }
+
+  void ReadRequests(const std::shared_ptr<Connection> &conn) {
+    std::string pending;
+    std::vector<char> buffer(kReadSize);
+    bool open = true;
+    while (open) {
+      ssize_t n = read(conn->in_fd, buffer.data(), buffer.size());
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      auto arrival = high_clock::now();
+      pending.append(buffer.data(), n);
+      size_t line_begin = 0, newline;
+      while (open && (newline = pending.find('\n', line_begin)) != std::string::npos) {
+        open = Enqueue(conn, pending.substr(line_begin, newline - line_begin), arrival);
+        line_begin = newline + 1;
+      }
+      pending.erase(0, line_begin);
+      if (pending.size() > kMaxLineSize) {
+        logger.Info("Request line longer than %lu bytes, closing the connection", kMaxLineSize);
+        pending.clear();
+        break;
+      }
+    }
+    // 最后一行可以没有换行符
+    if (open && !pending.empty()) Enqueue(conn, pending, high_clock::now());
+    conn->reader_done = true;
+  }
+
+  // 队列已关闭时返回 false
+  bool Enqueue(const std::shared_ptr<Connection> &conn, std::string line,
+    high_clock::time_point arrival) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    auto begin = line.data(), end = line.data() + line.size();
+    if (!LibsvmParser::IsRecord(begin, end)) return true;
+    Request request;
+    request.conn = conn;
+    request.arrival = arrival;
+    auto first = LibsvmParser::SkipSpaces(begin, end);
+    auto first_end = first;
+    while (first_end < end && !LibsvmParser::IsSpace(*first_end)) ++first_end;
+    std::string first_token(first, first_end);
+    if (first_token == "stats") {
+      request.is_stats = true;
+    } else if (first_token.find(':') != std::string::npos) {
+      // 没有标签时补一个占位的标签，与测试数据的格式一致
+      request.text = "0 " + line;
+    } else {
+      request.text = std::move(line);
+    }
+    return queue.Push(std::move(request));
+  }
+
+  void BatchLoop() {
+    std::vector<Request> batch;
+    Request request;
+    while (queue.Pop(request)) {
+      batch.clear();
+      batch.push_back(std::move(request));
+      auto deadline = batch.front().arrival + max_wait;
+      while (batch.size() < max_batch && queue.PopUntil(request, deadline)) {
+        batch.push_back(std::move(request));
+      }
+      ProcessBatch(batch);
+    }
+  }
+
+  void ProcessBatch(std::vector<Request> &batch) {
+    PROFILE_SCOPE("ServeBatch");
+    CsrMatrix rows;
+    rows.features_count = forest.features_count;
+    std::vector<std::pair<int, FeatureVal>> row_buffer;
+    // 每个请求在 rows 中的行号，不是打分请求或格式错误时为 -1
+    std::vector<int> row_of(batch.size(), -1);
+    std::vector<std::string> errors(batch.size());
+    for (int i = 0; i < batch.size(); ++i) {
+      if (batch[i].is_stats) continue;
+      auto &text = batch[i].text;
+      try {
+        LibsvmParser::AppendCsrRow(text.data(), text.data() + text.size(), rows, row_buffer);
+        row_of[i] = rows.rows_count - 1;
+      } catch (const std::string &e) {
+        errors[i] = e;
+      }
+    }
+    std::vector<std::pair<int, int>> votes(rows.rows_count, { 0, 0 });
+    if (rows.rows_count > 0) {
+      // 小批也分给所有线程
+      int chunk_size = std::min<int>(RandomForest::kTestBlockSize,
+        (rows.rows_count + pool.Size() - 1) / pool.Size());
+      pool.ParallelFor(0, rows.rows_count, chunk_size, [this, &rows, &votes](int begin, int end) {
+        auto block = FeatureMatrix::FromCsr(rows, begin, end, forest.features_count);
+        forest.VoteRows(block, 0, end - begin, votes.data() + begin);
+      });
+    }
+
+    // 先得到打分请求的回复并把这一批计入统计，同一批中的 stats 请求也包括这一批。
+    // 延迟算到结果就绪为止，不含写回复的时间
+    std::vector<std::string> lines(batch.size());
+    char line[256];
+    for (int i = 0; i < batch.size(); ++i) {
+      if (batch[i].is_stats) continue;
+      int n;
+      if (row_of[i] < 0) {
+        n = snprintf(line, sizeof(line), "error %s\n", errors[i].c_str());
+        ++error_count;
+      } else {
+        auto &res = votes[row_of[i]];
+        int total = res.first + res.second;
+        if (total == 0) {
+          n = snprintf(line, sizeof(line), "error no tree voted\n");
+          ++error_count;
+        } else {
+          // 与 SaveTest 相同，标签 0 的票数不少于一半时判为 0
+          int label = res.first >= res.second ? 0 : 1;
+          n = snprintf(line, sizeof(line), "%d %.4f\n", label,
+            double(label == 0 ? res.first : res.second) / total);
+        }
+      }
+      lines[i].assign(line, std::min<int>(n, sizeof(line) - 1));
+    }
+    auto now = high_clock::now();
+    for (auto &request : batch) {
+      if (request.is_stats) continue;
+      auto us = duration_cast<duration<double, std::micro>>(now - request.arrival).count();
+      if (latencies.size() < kLatencyWindow) {
+        latencies.push_back(us);
+      } else {
+        latencies[latency_next] = us;
+      }
+      latency_next = (latency_next + 1) % kLatencyWindow;
+      ++request_count;
+    }
+    ++batch_count;
+    for (int i = 0; i < batch.size(); ++i) {
+      if (!batch[i].is_stats) continue;
+      int n = FormatStats(line, sizeof(line));
+      lines[i].assign(line, std::min<int>(n, sizeof(line) - 1));
+    }
+
+    // 同一连接的回复先拼接起来，每个连接只写一次
+    std::vector<std::pair<Connection*, std::string>> replies;
+    std::unordered_map<Connection*, int> reply_index;
+    for (int i = 0; i < batch.size(); ++i) {
+      auto conn = batch[i].conn.get();
+      auto found = reply_index.find(conn);
+      if (found == reply_index.end()) {
+        found = reply_index.emplace(conn, replies.size()).first;
+        replies.push_back({ conn, std::string() });
+      }
+      replies[found->second].second += lines[i];
+    }
+    for (auto &reply : replies) WriteReply(*reply.first, reply.second);
+  }
+
+  void WriteReply(Connection &conn, const std::string &reply) {
+    if (conn.broken) return;
+    size_t written = 0;
+    while (written < reply.size()) {
+      // socket 对端已关闭时不产生 SIGPIPE
+      ssize_t n = conn.is_socket
+        ? send(conn.out_fd, reply.data() + written, reply.size() - written, MSG_NOSIGNAL)
+        : write(conn.out_fd, reply.data() + written, reply.size() - written);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        conn.broken = true;
+        return;
+      }
+      written += n;
+    }
+  }
+
+  double Percentile(std::vector<double> &sorted, double q) const {
+    if (sorted.empty()) return 0.0;
+    return sorted[std::min(sorted.size() - 1, size_t(q * sorted.size()))];
+  }
+
+  int FormatStats(char *line, size_t size) const {
+    std::vector<double> sorted(latencies);
+    std::sort(sorted.begin(), sorted.end());
+    double seconds = duration_cast<duration<double>>(high_clock::now() - start).count();
+    return snprintf(line, size,
+      "requests %lld batches %lld avg_batch %.2lf errors %lld throughput %.1lf/s "
+      "p50_us %.1lf p99_us %.1lf\n", request_count, batch_count,
+      batch_count ? double(request_count) / batch_count : 0.0, error_count,
+      request_count / seconds, Percentile(sorted, 0.5), Percentile(sorted, 0.99));
+  }
+
+  void LogSummary() {
+    char line[256];
+    FormatStats(line, sizeof(line));
+    line[strcspn(line, "\n")] = '\0';
+    logger.Info("Server stopped: %s", line);
+  }
+
+  const RandomForest &forest;
+  ThreadPool &pool;
+  int max_batch;
+  std::chrono::microseconds max_wait;
+  BoundedQueue<Request> queue;
+  Logger logger;
+  high_clock::time_point start;
+
+  // 以下只由批处理线程访问
+  long long request_count = 0, batch_count = 0, error_count = 0;
+  // 从读入请求到回复就绪的微秒数，环形保存最近 kLatencyWindow 个
+  std::vector<double> latencies;
+  size_t latency_next = 0;
+};
+
+#endif
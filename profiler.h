@@ -0,0 +1,254 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+// 分层的性能统计，编译时定义 RF_PROFILE 才生效 (make PROFILE=1)，否则下面的宏都是空的：
+//   PROFILE_SCOPE("name")          统计所在作用域的耗时，可以嵌套，按调用路径汇总
+//   PROFILE_COUNT(kCounter, n)     给当前线程的计数器加 n
+//   PROFILE_DETACH()               之后的作用域从根开始统计 (线程池执行任务时使用)
+// 每个线程的数据单独记录，不需要加锁；结束时 Profiler::Instance().Report() 打印
+// 按路径汇总的耗时和每个线程的计数器，WriteTrace 写出 Chrome trace event 格式
+// (chrome://tracing 或 Perfetto 中打开)。trace 需要事先 EnableTrace，每个线程最多记录
+// kMaxTraceEvents 个事件
+struct Profiler {
+  enum Counter {
+    kNodesBuilt,
+    kSplitsEvaluated,
+    kSamplesPartitioned,
+    kTreesScored,
+    kBytesRead,
+    kCountersCount
+  };
+
+  constexpr static size_t kMaxTraceEvents = 1 << 20;
+
+  static const char *CounterName(int counter) {
+    static const char *names[kCountersCount] = {
+      "nodes built", "candidate splits", "samples partitioned", "trees scored", "bytes read"
+    };
+    return names[counter];
+  }
+
+  struct ScopeNode {
+    const char *name;
+    int parent;
+    std::vector<int> children;
+    long long calls = 0;
+    long long total_ns = 0;
+  };
+
+  struct TraceEvent {
+    const char *name;
+    long long begin_ns, duration_ns;
+  };
+
+  // 只由所属线程写入；Report 时其他线程应已结束或空闲
+  struct ThreadData {
+    int index;
+    std::vector<ScopeNode> nodes = { { "", -1 } };
+    int current = 0;
+    long long counters[kCountersCount] = {};
+    std::vector<TraceEvent> events;
+  };
+
+  static Profiler &Instance() {
+    static Profiler profiler;
+    return profiler;
+  }
+
+  ThreadData &Current() {
+    static thread_local ThreadData *data = nullptr;
+    if (!data) {
+      std::lock_guard<std::mutex> lock(mutex);
+      threads.emplace_back(new ThreadData());
+      data = threads.back().get();
+      data->index = threads.size() - 1;
+    }
+    return *data;
+  }
+
+  long long NowNs() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  }
+
+  void EnableTrace() { tracing = true; }
+
+  void Count(Counter counter, long long n) {
+    Current().counters[counter] += n;
+  }
+
+  class Scope {
+   public:
+    explicit Scope(const char *name) : data(Instance().Current()) {
+      auto &parent = data.nodes[data.current];
+      int found = -1;
+      // 名字是字符串字面量，先比较指针
+      for (int child : parent.children) {
+        auto child_name = data.nodes[child].name;
+        if (child_name == name || strcmp(child_name, name) == 0) {
+          found = child;
+          break;
+        }
+      }
+      if (found < 0) {
+        found = data.nodes.size();
+        data.nodes.push_back({ name, data.current });
+        data.nodes[data.current].children.push_back(found);
+      }
+      data.current = found;
+      begin_ns = Instance().NowNs();
+    }
+
+    ~Scope() {
+      long long duration = Instance().NowNs() - begin_ns;
+      auto &node = data.nodes[data.current];
+      ++node.calls;
+      node.total_ns += duration;
+      if (Instance().tracing && data.events.size() < kMaxTraceEvents) {
+        data.events.push_back({ node.name, begin_ns, duration });
+      }
+      data.current = node.parent;
+    }
+
+    Scope(const Scope&) = delete;
+    Scope &operator=(const Scope&) = delete;
+
+   private:
+    ThreadData &data;
+    long long begin_ns;
+  };
+
+  // 线程池中的任务可能在等待其他任务的线程上被"帮忙"执行，任务内的作用域应挂在根下，
+  // 而不是等待者的作用域下
+  class Detach {
+   public:
+    Detach() : data(Instance().Current()), saved(data.current) {
+      data.current = 0;
+    }
+    ~Detach() {
+      data.current = saved;
+    }
+
+    Detach(const Detach&) = delete;
+    Detach &operator=(const Detach&) = delete;
+
+   private:
+    ThreadData &data;
+    int saved;
+  };
+
+  void Report(FILE *out = stdout) {
+    std::lock_guard<std::mutex> lock(mutex);
+    struct Total {
+      int depth;
+      long long calls = 0, total_ns = 0;
+    };
+    // 以 "a/b/c" 为键合并各线程，字典序使父路径排在子路径之前
+    std::map<std::string, Total> totals;
+    for (auto &thread : threads) {
+      std::vector<std::string> paths(thread->nodes.size());
+      for (int i = 1; i < thread->nodes.size(); ++i) {
+        auto &node = thread->nodes[i];
+        paths[i] = node.parent > 0 ? paths[node.parent] + "/" + node.name : node.name;
+        auto &total = totals[paths[i]];
+        total.depth = node.parent > 0 ? totals[paths[node.parent]].depth + 1 : 0;
+        total.calls += node.calls;
+        total.total_ns += node.total_ns;
+      }
+    }
+    fprintf(out, "==== Profile (wall time summed over threads) ====\n");
+    fprintf(out, "%-48s %12s %14s %12s\n", "scope", "calls", "total ms", "avg us");
+    for (auto &pair : totals) {
+      auto &total = pair.second;
+      auto slash = pair.first.rfind('/');
+      std::string name = std::string(total.depth * 2, ' ')
+        + (slash == std::string::npos ? pair.first : pair.first.substr(slash + 1));
+      fprintf(out, "%-48s %12lld %14.3lf %12.3lf\n", name.c_str(), total.calls,
+        total.total_ns / 1e6, total.calls ? total.total_ns / 1e3 / total.calls : 0.0);
+    }
+    fprintf(out, "\n%-8s", "thread");
+    for (int c = 0; c < kCountersCount; ++c) fprintf(out, " %20s", CounterName(c));
+    fprintf(out, "\n");
+    long long sums[kCountersCount] = {};
+    for (auto &thread : threads) {
+      fprintf(out, "%-8d", thread->index);
+      for (int c = 0; c < kCountersCount; ++c) {
+        fprintf(out, " %20lld", thread->counters[c]);
+        sums[c] += thread->counters[c];
+      }
+      fprintf(out, "\n");
+    }
+    fprintf(out, "%-8s", "total");
+    for (int c = 0; c < kCountersCount; ++c) fprintf(out, " %20lld", sums[c]);
+    fprintf(out, "\n");
+  }
+
+  bool WriteTrace(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ofstream ofs(filename);
+    if (!ofs.is_open()) return false;
+    ofs << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    char line[256];
+    for (auto &thread : threads) {
+      for (auto &event : thread->events) {
+        snprintf(line, sizeof(line),
+          "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3lf, "
+          "\"dur\": %.3lf}", first ? "" : ",\n", event.name, thread->index,
+          event.begin_ns / 1e3, event.duration_ns / 1e3);
+        ofs << line;
+        first = false;
+      }
+      // 计数器作为线程结束时的一个 counter 事件
+      long long end_ns = thread->events.empty() ? 0
+        : thread->events.back().begin_ns + thread->events.back().duration_ns;
+      snprintf(line, sizeof(line), "%s{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, "
+        "\"tid\": %d, \"ts\": %.3lf, \"args\": {", first ? "" : ",\n", thread->index,
+        end_ns / 1e3);
+      ofs << line;
+      for (int c = 0; c < kCountersCount; ++c) {
+        ofs << (c ? ", " : "") << '"' << CounterName(c) << "\": " << thread->counters[c];
+      }
+      ofs << "}}";
+      first = false;
+    }
+    ofs << "\n]}\n";
+    return bool(ofs);
+  }
+
+ private:
+  Profiler() : start(std::chrono::steady_clock::now()) {}
+
+  std::chrono::steady_clock::time_point start;
+  bool tracing = false;
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadData>> threads;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef RF_PROFILE
+#define PROFILE_ENABLED 1
+#define PROFILE_SCOPE(name) Profiler::Scope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNT(counter, n) Profiler::Instance().Count(Profiler::counter, (n))
+#define PROFILE_DETACH() Profiler::Detach PROFILE_CONCAT(profile_detach_, __LINE__)
+#else
+#define PROFILE_ENABLED 0
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_DETACH() ((void)0)
+#endif
+
+#endif
@@ -3,126 +3,405 @@
 
 #include "decision-tree.h"
 #include <string>
+#include <cstring>
+#include <cstdint>
+#include <memory>
 #include <fstream>
+#include <iostream>
 #include <exception>
 #include <thread>
-#include "simple-threadpool.h"
+#include <mutex>
+#include <algorithm>
+#include <optional>
+#include <deque>
+#include <atomic>
+#include <cstdio>
+#include <unistd.h>
+#include "thread-pool.h"
+#include "mapped-file.h"
+#include "model-file.h"
+#include "simd-traversal.h"
+#include "profiler.h"
 
 using DecisionTreeInfo = DecisionTree::DecisionTreeInfo;
 using TreeNode = DecisionTree::TreeNode;
 
 struct RandomForest {
-  RandomForest(int features_count, const std::vector<Sample> &samples, int threading = 0,
+  RandomForest(int features_count, const FeatureMatrix &matrix, int threading = 0,
     const DecisionTreeInfo info = DecisionTreeInfo(), int tree_count = 100,
     int one_sample_size = 1000, const Logger &logger = Logger())
-    : samples(samples), threading(threading), features_count(features_count),
+    : matrix(matrix), threading(threading), features_count(features_count),
       logger(logger), decision_tree_info(info), tree_count(tree_count),
       one_sample_size(one_sample_size) {
     decision_tree_info.features_count = features_count;
     decision_tree_info.max_features = sqrt(features_count);
+    build_tree = SelectBuildTree(decision_tree_info.criterion);
 
     // Output info
     std::string infos;
     infos += "\n\tmax-depth: " + std::to_string(decision_tree_info.max_depth) + '\n'
            + "\tmin-split: " + std::to_string(decision_tree_info.min_samples_split) + '\n'
            + "\ttree-count: " + std::to_string(tree_count) + '\n'
-           + "\tsample-size: " + std::to_string(one_sample_size) + '\n';
+           + "\tsample-size: " + std::to_string(one_sample_size) + '\n'
+           + "\tcriterion: " + SplitCriterionName(decision_tree_info.criterion) + '\n';
     this->logger.Debug(infos.c_str());
   }
 
+  using BuildTreeFunc = void (DecisionTree::*)(const FeatureMatrix &, RowIndexVec);
+
+  static BuildTreeFunc SelectBuildTree(SplitCriterion criterion) {
+    switch (criterion) {
+      case SplitCriterion::kEntropy: return &DecisionTree::BuildTree<EntropyCriterion>;
+      case SplitCriterion::kMisclassification:
+        return &DecisionTree::BuildTree<MisclassificationCriterion>;
+      default: return &DecisionTree::BuildTree<GiniCriterion>;
+    }
+  }
+
+  // 格式见 model-file.h。先完整写入 filename.tmp 并 fsync，再 rename 覆盖 filename：
+  // 中途崩溃时旧文件保持完整；已经 mmap 旧文件的树 (warm start) 仍指向旧的 inode，不受影响
   void SaveTreesToFile(const std::string filename) {
+    PROFILE_SCOPE("SaveTrees");
     logger.Info("Saving trees to file...");
-    std::ofstream ofs;
-    int one_tree_size = sizeof(TreeNode) * pow(2, decision_tree_info.max_depth);
-    ofs.open(filename, std::ios_base::binary);
-    if (ofs.is_open()) {
-      for (auto &tree : trees) {
-        ofs.write(reinterpret_cast<const char*>(tree.tree), one_tree_size);
-      }
-    } else {
+    std::vector<ModelTreeEntry> entries;
+    uint64_t nodes_count = 0, leaves_count = 0;
+    uint32_t max_depth = decision_tree_info.max_depth;
+    for (auto &tree : trees) {
+      entries.push_back({ nodes_count, leaves_count,
+        uint32_t(tree.NodesCount()), uint32_t(tree.LeavesCount()) });
+      nodes_count += tree.NodesCount();
+      leaves_count += tree.LeavesCount();
+      max_depth = std::max<uint32_t>(max_depth, tree.max_depth);
+    }
+    ModelFileHeader header = {};
+    memcpy(header.magic, kModelMagic, sizeof(kModelMagic));
+    header.version = kModelVersion;
+    header.node_size = sizeof(TreeNode);
+    header.features_count = features_count;
+    header.max_depth = max_depth;
+    header.tree_count = trees.size();
+    header.nodes_count = nodes_count;
+    header.leaves_count = leaves_count;
+    size_t entries_size = sizeof(ModelTreeEntry) * entries.size();
+    header.nodes_offset = AlignUp(sizeof(header) + entries_size, kModelSectionAlign);
+    header.leaves_offset = header.nodes_offset + sizeof(TreeNode) * nodes_count;
+    std::vector<char> padding(header.nodes_offset - sizeof(header) - entries_size, 0);
+
+    auto checksum = Fnv1a(entries.data(), entries_size);
+    checksum = Fnv1a(padding.data(), padding.size(), checksum);
+    for (auto &tree : trees) {
+      checksum = Fnv1a(tree.Nodes(), sizeof(TreeNode) * tree.NodesCount(), checksum);
+    }
+    for (auto &tree : trees) {
+      checksum = Fnv1a(tree.LeafLabels(), tree.LeavesCount(), checksum);
+    }
+    header.checksum = checksum;
+
+    std::string tmp_filename = filename + ".tmp";
+    FILE *fd = fopen(tmp_filename.c_str(), "wb");
+    if (!fd) {
       throw std::string("Something wrong in opening file");
     }
+    fwrite(&header, sizeof(header), 1, fd);
+    fwrite(entries.data(), 1, entries_size, fd);
+    fwrite(padding.data(), 1, padding.size(), fd);
+    for (auto &tree : trees) {
+      fwrite(tree.Nodes(), sizeof(TreeNode), tree.NodesCount(), fd);
+    }
+    for (auto &tree : trees) {
+      fwrite(tree.LeafLabels(), 1, tree.LeavesCount(), fd);
+    }
+    bool failed = fflush(fd) != 0 || ferror(fd) || fsync(fileno(fd)) != 0;
+    failed = fclose(fd) != 0 || failed;
+    if (failed || rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+      remove(tmp_filename.c_str());
+      throw std::string("Something wrong in writing file");
+    }
     logger.Info("Saving trees done.");
   }
 
-  void LoadTreesFromFile(const std::string filename) {
+  // 树直接指向 mmap 的文件内容，加载时间与树的数量和大小无关；
+  // verify_checksum 为 true 时会完整读一遍文件以校验 checksum
+  void LoadTreesFromFile(const std::string filename, bool verify_checksum = false) {
+    PROFILE_SCOPE("LoadTrees");
     logger.Info("Loading trees from file...");
-    std::ifstream ifs;
-    int one_tree_size = sizeof(TreeNode) * pow(2, decision_tree_info.max_depth);
-    ifs.open(filename, std::ios_base::binary);
-    if (ifs.is_open()) {
-      while (!ifs.eof()) {
-        DecisionTree d_tree(CalcGini);
-        d_tree.FromInfo(decision_tree_info);
-        char *buffer = new char[one_tree_size];
-        ifs.read(buffer, one_tree_size);
-        d_tree.tree = (reinterpret_cast<TreeNode*>(buffer));
-        trees.push_back(std::move(d_tree));
+    auto file = std::make_shared<MappedFile>(filename);
+    auto data = file->Data();
+    auto size = file->Size();
+    ModelFileHeader header;
+    if (size < sizeof(header)) {
+      throw std::string("Not a model file: ") + filename;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, kModelMagic, sizeof(kModelMagic)) != 0) {
+      throw std::string("Not a model file: ") + filename;
+    }
+    if (header.version != kModelVersion) {
+      throw std::string("Unsupported model version ") + std::to_string(header.version);
+    }
+    if (header.node_size != sizeof(TreeNode)) {
+      throw std::string("Model node layout mismatch");
+    }
+    if (header.features_count != features_count) {
+      throw std::string("Model expects ") + std::to_string(header.features_count)
+        + " features, got " + std::to_string(features_count);
+    }
+    if (header.nodes_offset < sizeof(header) + sizeof(ModelTreeEntry) * header.tree_count
+      || header.nodes_offset % kModelSectionAlign != 0
+      || header.leaves_offset != header.nodes_offset + sizeof(TreeNode) * header.nodes_count
+      || header.leaves_offset + header.leaves_count > size) {
+      throw std::string("Model file is truncated or corrupted: ") + filename;
+    }
+    if (verify_checksum
+      && Fnv1a(data + sizeof(header), size - sizeof(header)) != header.checksum) {
+      throw std::string("Model checksum mismatch: ") + filename;
+    }
+    decision_tree_info.max_depth = header.max_depth;
+
+    auto entries = reinterpret_cast<const ModelTreeEntry*>(data + sizeof(header));
+    auto nodes = reinterpret_cast<const TreeNode*>(data + header.nodes_offset);
+    auto leaf_labels = reinterpret_cast<const LabelType*>(data + header.leaves_offset);
+    trees.reserve(trees.size() + header.tree_count);
+    for (uint32_t i = 0; i < header.tree_count; ++i) {
+      auto &entry = entries[i];
+      if (entry.first_node + entry.nodes_count > header.nodes_count
+        || entry.first_leaf + entry.leaves_count > header.leaves_count) {
+        throw std::string("Model file is truncated or corrupted: ") + filename;
       }
-    } else {
-      throw std::string("Something wrong in opening file");
+      DecisionTree d_tree;
+      d_tree.FromInfo(decision_tree_info);
+      d_tree.mapped_nodes = nodes + entry.first_node;
+      d_tree.mapped_leaf_labels = leaf_labels + entry.first_leaf;
+      d_tree.mapped_nodes_count = entry.nodes_count;
+      d_tree.mapped_leaves_count = entry.leaves_count;
+      trees.push_back(std::move(d_tree));
     }
+    PROFILE_COUNT(kBytesRead, file->Size());
+    model_files.push_back(std::move(file));
     logger.Info("Loading trees done.");
   }
 
-  DecisionTree CalcOneTree(int id) {
-    TikTok tt("CalcOneTree id: " + std::to_string(id));
-    tt.Tik();
-    DecisionTree tree(CalcGini, Logger(), id);
+  // 载入已有的模型，之后 CalcTrees 在它后面再建 tree_count 棵树。新树的编号接着已有的树，
+  // 同一个 seed 下先建 m 棵再 warm start n 棵与直接建 m + n 棵得到相同的模型
+  void WarmStart(const std::string &filename) {
+    // 新树仍按本次的参数建，不使用模型文件里的 max_depth
+    int max_depth = decision_tree_info.max_depth;
+    LoadTreesFromFile(filename, true);
+    decision_tree_info.max_depth = max_depth;
+    logger.Info("Warm start from %s with %lu trees", filename.c_str(), trees.size());
+  }
+
+  // 不放回地取 one_sample_size 个样本，bootstrap 时有放回地取
+  RowIndexVec SampleRows(Randomer &randomer) const {
+    return bootstrap ? randomer.SampleWithReplacement(matrix.rows_count, one_sample_size)
+                     : randomer.Sample(matrix.rows_count, one_sample_size);
+  }
+
+  // pool 不为空时树内的工作也会分到线程池上
+  DecisionTree CalcOneTree(int id, ThreadPool *pool = nullptr) {
+    PROFILE_SCOPE("CalcOneTree");
+    DecisionTree tree(Logger(), id);
     tree.FromInfo(decision_tree_info);
-    // 随机采样
-    SamplePtrVec vec;
-    std::vector<int> rand_indexes;
-    for (int i = 0; i < one_sample_size; ++i) {
-      int rand_index = Randomer::RandInt(0, samples.size());
-      while (std::find(rand_indexes.begin(), rand_indexes.end(), rand_index)
-        != rand_indexes.end()) {
-        rand_index = Randomer::RandInt(0, samples.size());
+    // 每棵树使用编号为 id 的独立随机数流，结果与建树的先后顺序无关
+    Randomer randomer(seed, id);
+    tree.seed = randomer.Next();
+    tree.pool = pool;
+    if (!matrix_columns.columns.empty()) tree.matrix_columns = &matrix_columns;
+    auto samples = SampleRows(randomer);
+    std::vector<char> in_bag;
+    if (oob) {
+      in_bag.assign(matrix.rows_count, 0);
+      for (auto row : samples) in_bag[row] = 1;
+    }
+    (tree.*build_tree)(matrix, std::move(samples));
+    tree.pool = nullptr;
+    tree.matrix_columns = nullptr;
+    if (oob) EvaluateOob(tree, in_bag);
+    return tree;
+  }
+
+  // 用树没有见过的样本 (out-of-bag) 评估它：预测结果累加到 oob_votes；
+  // importance 时再对树中用到的每个特征，把它在这些样本间随机置换后重新预测，
+  // 错误率的增加量记在 tree_importance[tree.id]。其余特征置换后预测不变，贡献为 0
+  void EvaluateOob(const DecisionTree &tree, const std::vector<char> &in_bag) {
+    PROFILE_SCOPE("EvaluateOob");
+    RowIndexVec oob_rows;
+    for (int row = 0; row < matrix.rows_count; ++row) {
+      if (!in_bag[row]) oob_rows.push_back(row);
+    }
+    if (oob_rows.empty()) return;
+    std::vector<LabelType> predictions(oob_rows.size());
+    int errors = 0;
+    for (int i = 0; i < oob_rows.size(); ++i) {
+      predictions[i] = tree.TestTree(matrix, oob_rows[i]);
+      if (predictions[i] != matrix.Label(oob_rows[i])) ++errors;
+    }
+    {
+      std::lock_guard<std::mutex> lock(oob_mutex);
+      for (int i = 0; i < oob_rows.size(); ++i) {
+        if (predictions[i] == 0) {
+          oob_votes[oob_rows[i]].first++;
+        } else if (predictions[i] == 1) {
+          oob_votes[oob_rows[i]].second++;
+        }
       }
-      rand_indexes.push_back(rand_index);
     }
-    for (auto index : rand_indexes) {
-      vec.push_back(&samples[index]);
+    if (!importance) return;
+    // 每棵树只写自己的一项，最后按编号顺序汇总，结果与线程调度无关
+    auto &deltas = tree_importance[tree.id];
+    deltas.assign(features_count, 0.0);
+    int n = oob_rows.size();
+    for (auto feature : tree.UsedFeatures()) {
+      auto permutation = Randomer(Randomer::Mix(tree.seed), feature).Sample(n, n);
+      int permuted_errors = 0;
+      for (int i = 0; i < n; ++i) {
+        auto label = tree.TestTreePermuted(matrix, oob_rows[i], feature,
+          oob_rows[permutation[i]]);
+        if (label != matrix.Label(oob_rows[i])) ++permuted_errors;
+      }
+      deltas[feature] = double(permuted_errors - errors) / n;
     }
-    tree.BuildTree(vec);
-    tt.Tok();
-    return tree;
+  }
+
+  // 训练结束后输出 OOB 准确率；importance 时输出最重要的特征并写入 importance_file
+  void ReportOob() {
+    int evaluated = 0, correct = 0;
+    for (int row = 0; row < matrix.rows_count; ++row) {
+      auto &votes = oob_votes[row];
+      if (votes.first + votes.second == 0) continue;
+      ++evaluated;
+      // 与 Test 相同，label 0 的票数不少于一半时判为 0
+      LabelType label = votes.first >= votes.second ? 0 : 1;
+      if (label == matrix.Label(row)) ++correct;
+    }
+    if (evaluated == 0) {
+      logger.Info("No out-of-bag samples, every row was used by every tree");
+      return;
+    }
+    logger.Info("OOB accuracy: %lf on %d samples (%d samples were in every tree's bag)",
+      double(correct) / evaluated, evaluated, matrix.rows_count - evaluated);
+    if (!importance) return;
+
+    std::vector<double> feature_importance(features_count, 0.0);
+    int trees_evaluated = 0;
+    for (auto &deltas : tree_importance) {
+      if (deltas.empty()) continue;
+      ++trees_evaluated;
+      for (int f = 0; f < features_count; ++f) feature_importance[f] += deltas[f];
+    }
+    for (auto &val : feature_importance) val /= std::max(trees_evaluated, 1);
+    std::vector<int> order(features_count);
+    for (int f = 0; f < features_count; ++f) order[f] = f;
+    std::stable_sort(order.begin(), order.end(), [&feature_importance](int lhs, int rhs) {
+      return feature_importance[lhs] > feature_importance[rhs];
+    });
+    int unused = std::count(feature_importance.begin(), feature_importance.end(), 0.0);
+    logger.Info("Permutation importance (mean increase of OOB error), %d features never matter:",
+      unused);
+    for (int i = 0; i < std::min(10, features_count); ++i) {
+      logger.Info("\tfeature %d: %lf", order[i], feature_importance[order[i]]);
+    }
+    std::ofstream ofs(importance_file);
+    if (!ofs.is_open()) {
+      throw std::string("File not opened: ") + importance_file;
+    }
+    ofs << "feature,importance\n";
+    for (int f = 0; f < features_count; ++f) ofs << f << "," << feature_importance[f] << '\n';
+    logger.Info("Feature importance saved to %s", importance_file.c_str());
   }
 
   void CalcTrees() {
+    PROFILE_SCOPE("CalcTrees");
+    logger.Info("Training with seed %llu%s", (unsigned long long)seed,
+      bootstrap ? ", bootstrap sampling" : "");
+    int first_id = trees.size();
+    oob = oob || importance;
+    if (oob) {
+      // warm start 时只统计本次新建的树
+      oob_votes.assign(matrix.rows_count, { 0, 0 });
+      tree_importance.assign(first_id + tree_count, {});
+    }
     if (threading == 0) {
       // 无并行
       logger.Info("Use no parallel mode");
+      PrepareMatrixColumns(nullptr);
       // 循环 tree_count 次，生成 tree_count 棵决策树
-      for (int i = 0; i < tree_count; ++i) {
-        trees.push_back(CalcOneTree(i));
+      for (int i = 0; i < tree_count && !stop_requested; ++i) {
+        trees.push_back(CalcOneTree(first_id + i));
+        CheckpointIfDue(first_id);
       }
+    } else {
+      CalcTreesParallel(first_id);
+    }
+    matrix_columns = SparseColumns();
+    int grown = trees.size() - first_id;
+    if (grown < tree_count) {
+      logger.Info("Stopped after %d of %d trees", grown, tree_count);
+      // 被丢弃的树已经计入了 OOB 投票
       return;
     }
-    // 并行
-    int thread_count = threading;
-    if (threading < 0) {
-      logger.Info("No thread_count specified, check cpu cores...");
-      thread_count = std::thread::hardware_concurrency();
+    if (oob) ReportOob();
+  }
+
+  // exact 模式下所有树的样本加起来不少于矩阵的行数时为整个矩阵排序一次，
+  // 之后每棵树用 SparseColumns::Select 取出自己的样本，不必各自排序
+  void PrepareMatrixColumns(ThreadPool *pool) {
+    if (decision_tree_info.split_mode != DecisionTree::SplitMode::kExact
+      || (long long)tree_count * one_sample_size < matrix.rows_count) {
+      return;
     }
-    logger.Info("Use %d threads to calculate", thread_count);
-    SimpleThreadPool pool(thread_count);
-    for (int i = 0; i < tree_count; ++i) {
-      logger.Info("Adding %d-th job...", i);
-      pool.AddJob([this, i]() {
-        auto tree = CalcOneTree(i);
+    PROFILE_SCOPE("MatrixColumns");
+    matrix_columns = SparseColumns::FromMatrix(matrix, pool, decision_tree_info.parallel_cutoff);
+  }
 
-        trees_mutex.lock();
-        this->trees.push_back(std::move(tree));
-        trees_mutex.unlock();
+  // 每新增 checkpoint_every 棵树写一次 checkpoint_file。只在收集线程上调用，
+  // 此时其他线程仍在建后面的树
+  void CheckpointIfDue(int first_id) {
+    int grown = trees.size() - first_id;
+    if (checkpoint_every <= 0 || grown % checkpoint_every != 0 || grown == tree_count) return;
+    SaveTreesToFile(checkpoint_file);
+    logger.Info("Checkpoint: %lu trees saved to %s", trees.size(), checkpoint_file.c_str());
+  }
 
+  void CalcTreesParallel(int first_id) {
+    // 并行
+    int thread_count = ThreadCount(threading);
+    logger.Info("Use %d threads to calculate", thread_count);
+    ThreadPool pool(thread_count);
+    PrepareMatrixColumns(&pool);
+    // 同时最多有 window 棵树在建。线程池按 LIFO 执行，一次提交全部时编号大的树先完成，
+    // 按编号连续的前缀 (checkpoint 和停止时保存的树) 要到最后才会增长
+    int window = std::max(thread_count, 1) * 2;
+    std::deque<std::future<std::optional<DecisionTree>>> in_flight;
+    int next_id = first_id;
+    auto submit_next = [this, &pool, &in_flight, &next_id]() {
+      int i = next_id++;
+      logger.Info("Adding %d-th job...", i);
+      in_flight.push_back(pool.Submit([this, i, &pool]() {
+        // 收到停止请求后不再开始新的树
+        if (stop_requested) return std::optional<DecisionTree>();
+        auto tree = CalcOneTree(i, &pool);
         this->logger.Info("The %d-th job finished", i);
-      });
+        return std::optional<DecisionTree>(std::move(tree));
+      }));
+    };
+    int end_id = first_id + tree_count;
+    while (next_id < end_id && next_id - first_id < window) submit_next();
+    // 按编号收集，trees 总是编号连续的前缀，checkpoint 和停止后都可以直接 warm start 继续
+    bool stopped = false;
+    while (!in_flight.empty()) {
+      auto tree = in_flight.front().get();
+      in_flight.pop_front();
+      stopped = stopped || !tree;
+      if (stopped) continue;
+      trees.push_back(std::move(*tree));
+      if (next_id < end_id && !stop_requested) submit_next();
+      CheckpointIfDue(first_id);
     }
   }
 
-  LabelType TestOne(const Sample &sample, DecisionTree &tree) {
-    auto type = tree.TestTree(sample);
+  LabelType TestOne(int row, const DecisionTree &tree) {
+    auto type = tree.TestTree(matrix, row);
     return type;
   }
 
@@ -131,88 +410,270 @@ struct RandomForest {
     SaveTest(filename);
   }
 
+  // filename 为 "-" 时写到 stdout
   void SaveTest(const std::string &filename) {
     logger.Info("Saving test result...");
-    std::ofstream ofs(filename);
+    std::ofstream file_ofs;
+    if (filename != "-") file_ofs.open(filename);
+    std::ostream &ofs = filename == "-" ? std::cout : file_ofs;
     std::ofstream dr_ofs("_decision_res.txt");
     ofs << "id,label\n";
     for (int i = 0; i < decision_res.size(); ++i) {
       auto &res = decision_res[i];
       double rate = double(res.first) / (res.first + res.second);
-      dr_ofs << i << " " << res.first << " " << res.second << std::endl;
-      ofs << i << "," << rate << std::endl;
+      dr_ofs << i << " " << res.first << " " << res.second << '\n';
+      ofs << i << "," << rate << '\n';
     }
     logger.Info("Saving test result done.");
   }
 
-  inline void AddDecisionWithType(LabelType type, int index) {
-    if (type == 0) {
-      decision_res[index].first++;
-    } else if (type == 1) {
-      decision_res[index].second++;
-    } else {
-      logger.Debug("Type %d is abnormal", type);
+  constexpr static int kTestBlockSize = 256;
+
+  // rows 中 [begin, end) 的样本依次经过所有的树，票数累加到 votes[0, end - begin)，
+  // 返回异常结果 (-2) 的个数。Matrix 可以是 FeatureMatrix 或 CsrMatrix
+  template <typename Matrix>
+  int VoteRows(const Matrix &rows, int begin, int end, std::pair<int, int> *votes) const {
+    if (early_exit) return VoteRowsEarlyExit(rows, begin, end, votes);
+    return VoteTrees(rows, begin, end, votes, 0, trees.size());
+  }
+
+  // 只由 trees 中 [tree_begin, tree_end) 的树投票
+  template <typename Matrix>
+  int VoteTrees(const Matrix &rows, int begin, int end, std::pair<int, int> *votes,
+    int tree_begin, int tree_end) const {
+    PROFILE_COUNT(kTreesScored, (long long)(tree_end - tree_begin) * (end - begin));
+    int abnormal_count = 0;
+    for (int t = tree_begin; t < tree_end; ++t) {
+      auto &tree = trees[t];
+      for (int i = begin; i < end; ++i) {
+        auto type = tree.TestTree(rows, i);
+        if (type == 0) {
+          votes[i - begin].first++;
+        } else if (type == 1) {
+          votes[i - begin].second++;
+        } else {
+          ++abnormal_count;
+        }
+      }
+    }
+    return abnormal_count;
+  }
+
+  // 稠密矩阵上用 SIMD 内核一次遍历一批样本，结果与上面的逐样本版本完全相同
+  int VoteTrees(const FeatureMatrix &rows, int begin, int end, std::pair<int, int> *votes,
+    int tree_begin, int tree_end) const {
+    if (kernel == TraversalKernel::kScalar) {
+      return VoteTrees<FeatureMatrix>(rows, begin, end, votes, tree_begin, tree_end);
+    }
+    PROFILE_COUNT(kTreesScored, (long long)(tree_end - tree_begin) * (end - begin));
+    int abnormal_count = 0;
+    LabelType labels[kTestBlockSize];
+    for (int block_begin = begin; block_begin < end; block_begin += kTestBlockSize) {
+      int block_end = std::min(end, block_begin + kTestBlockSize);
+      auto block_votes = votes + (block_begin - begin);
+      for (int t = tree_begin; t < tree_end; ++t) {
+        TraverseTree(kernel, trees[t], rows, block_begin, block_end, labels);
+        for (int i = 0; i < block_end - block_begin; ++i) {
+          if (labels[i] == 0) {
+            block_votes[i].first++;
+          } else if (labels[i] == 1) {
+            block_votes[i].second++;
+          } else {
+            ++abnormal_count;
+          }
+        }
+      }
+    }
+    return abnormal_count;
+  }
+
+  // 与 VoteRows 相同，但每棵树之后去掉结果已经确定的样本，剩下的树不再为它们投票。
+  // 在任何样本都不可能确定之前的树仍整段批量遍历 (可以使用 SIMD 内核)，之后逐样本遍历；
+  // 实际遍历的 (树, 样本) 数累加到 trees_scored
+  template <typename Matrix>
+  int VoteRowsEarlyExit(const Matrix &rows, int begin, int end,
+    std::pair<int, int> *votes) const {
+    double bound = EarlyExitBound();
+    int warm = MinDecidingVotes(bound) - 1;
+    int abnormal_count = VoteTrees(rows, begin, end, votes, 0, warm);
+    long long evaluated = 0;
+    int active[kTestBlockSize];
+    for (int block_begin = begin; block_begin < end; block_begin += kTestBlockSize) {
+      int active_count = std::min(end, block_begin + kTestBlockSize) - block_begin;
+      for (int k = 0; k < active_count; ++k) active[k] = block_begin - begin + k;
+      for (int t = warm; t < trees.size() && active_count > 0; ++t) {
+        auto &tree = trees[t];
+        int remaining = trees.size() - t - 1;
+        int kept = 0;
+        for (int k = 0; k < active_count; ++k) {
+          int i = active[k];
+          auto type = tree.TestTree(rows, begin + i);
+          if (type == 0) {
+            votes[i].first++;
+          } else if (type == 1) {
+            votes[i].second++;
+          } else {
+            ++abnormal_count;
+          }
+          if (!VoteDecided(votes[i], remaining, bound)) active[kept++] = i;
+        }
+        evaluated += active_count;
+        active_count = kept;
+      }
     }
+    PROFILE_COUNT(kTreesScored, evaluated);
+    trees_scored += evaluated + (long long)warm * (end - begin);
+    return abnormal_count;
+  }
+
+  // 至少要有这么多棵树投票，VoteDecided 才可能成立
+  int MinDecidingVotes(double bound) const {
+    int votes = (trees.size() + 1) / 2;
+    if (bound > 0.0) votes = std::min(votes, int(std::ceil(bound)));
+    return std::max(votes, 1);
+  }
+
+  // Hoeffding 界：n 票中领先 margin 票时，全部树的多数与之不同的概率不超过
+  // exp(-margin^2 / 2n)，不超过 1 - early_exit_confidence 时即可停止。返回 2 ln(1 / (1 - c))，
+  // 没有设置 confidence 时为 0
+  double EarlyExitBound() const {
+    if (early_exit_confidence <= 0.0 || early_exit_confidence >= 1.0) return 0.0;
+    return 2.0 * std::log(1.0 / (1.0 - early_exit_confidence));
+  }
+
+  // 还有 remaining 棵树没有投票时，硬标签是否已经确定。与 SaveTest 的 rate 一致，
+  // 标签 0 的票数不少于标签 1 时判为 0，因此剩下的树全部投给落后的一方也无法翻转时结果是精确的
+  static bool VoteDecided(const std::pair<int, int> &votes, int remaining, double bound) {
+    if (votes.first >= votes.second + remaining || votes.second > votes.first + remaining) {
+      return true;
+    }
+    int n = votes.first + votes.second;
+    double margin = votes.first - votes.second;
+    return bound > 0.0 && n > 0 && margin * margin >= bound * n;
+  }
+
+  // 用 rows 的前 sample_count 个样本上完整投票的多数作为参照，按与它一致的比例从高到低
+  // 重排 trees，early exit 时更早确定结果。不改变精确投票的结果
+  void ReorderTrees(const FeatureMatrix &rows, int sample_count) {
+    sample_count = std::min(sample_count, rows.rows_count);
+    if (sample_count == 0 || trees.empty()) {
+      logger.Info("No samples to reorder the trees with");
+      return;
+    }
+    std::vector<std::pair<int, int>> votes(sample_count, { 0, 0 });
+    VoteTrees(rows, 0, sample_count, votes.data(), 0, trees.size());
+    std::vector<int> agreement(trees.size(), 0);
+    for (int t = 0; t < trees.size(); ++t) {
+      for (int i = 0; i < sample_count; ++i) {
+        LabelType majority = votes[i].first >= votes[i].second ? 0 : 1;
+        agreement[t] += trees[t].TestTree(rows, i) == majority;
+      }
+    }
+    std::vector<int> order(trees.size());
+    for (int t = 0; t < trees.size(); ++t) order[t] = t;
+    std::stable_sort(order.begin(), order.end(), [&agreement](int lhs, int rhs) {
+      return agreement[lhs] > agreement[rhs];
+    });
+    std::vector<DecisionTree> reordered;
+    reordered.reserve(trees.size());
+    for (auto t : order) reordered.push_back(std::move(trees[t]));
+    trees.swap(reordered);
+    logger.Info("Reordered %lu trees by agreement on %d samples (best %.3lf, worst %.3lf)",
+      trees.size(), sample_count, double(agreement[order.front()]) / sample_count,
+      double(agreement[order.back()]) / sample_count);
+  }
+
+  // 一个块内的样本依次经过所有的树，票数先记在块内，最后一次性写回 decision_res；
+  // 不同的块写入不相交的区间，因此并行时无需加锁。返回异常结果 (-2) 的个数
+  int TestBlock(int begin, int end) {
+    PROFILE_SCOPE("TestBlock");
+    std::vector<std::pair<int, int>> votes(end - begin);
+    int abnormal_count = VoteRows(matrix, begin, end, votes.data());
+    std::copy(votes.begin(), votes.end(), decision_res.begin() + begin);
+    return abnormal_count;
   }
 
   void Test() {
-    decision_res.resize(samples.size());
+    PROFILE_SCOPE("Test");
+    decision_res.assign(matrix.rows_count, { 0, 0 });
+    trees_scored = 0;
+    std::atomic<int> abnormal_count{0};
+    auto start = high_clock::now();
     if (threading == 0) {
       // 无并行
       logger.Info("Use no parallel mode");
-      for (auto &tree : trees) {
-        TikTok tt("One Tree to all samples");
-        tt.Tik();
-        for (int i = 0; i < samples.size(); ++i) {
-          auto &sample = samples[i];
-
-          auto type = TestOne(samples[i], tree);
-          AddDecisionWithType(type, i);
-        }
-        tt.Tok();
+      for (int begin = 0; begin < matrix.rows_count; begin += kTestBlockSize) {
+        abnormal_count += TestBlock(begin, std::min(matrix.rows_count, begin + kTestBlockSize));
       }
-      return;
+    } else {
+      // 并行
+      int thread_count = ThreadCount(threading);
+      logger.Info("Use %d threads to calculate", thread_count);
+      ThreadPool pool(thread_count);
+      pool.ParallelFor(0, matrix.rows_count, kTestBlockSize,
+        [this, &abnormal_count](int begin, int end) {
+          abnormal_count += TestBlock(begin, end);
+        });
     }
-    // 并行
-    int thread_count = threading;
-    if (threading < 0) {
-      logger.Info("No thread_count specified, check cpu cores...");
-      thread_count = std::thread::hardware_concurrency();
+    double seconds = duration_cast<duration<double>>(high_clock::now() - start).count();
+    if (abnormal_count > 0) {
+      logger.Debug("%d decisions are abnormal", abnormal_count.load());
     }
-    logger.Info("Use %d threads to calculate", thread_count);
-    SimpleThreadPool pool(thread_count);
-    for (int i = 0; i < trees.size(); ++i) {
-      auto &tree = trees[i];
-      TikTok tt("One Tree to all samples");
-      tt.Tik();
-      logger.Info("Processing %d-th tree", i);
-      for (int j = 0; j < samples.size(); ++j) {
-        pool.AddJob([this, j, &tree]() {
-          auto &sample = this->samples[j];
-          auto type = TestOne(sample, tree);
-
-          // decision_res_mutex.lock();
-          AddDecisionWithType(type, j);
-          // decision_res_mutex.unlock();
-        });
-      }
-      tt.Tok();
+    logger.Info("Tested %d samples with %lu trees in %lf s (%.0lf samples/s, %s kernel)",
+      matrix.rows_count, trees.size(), seconds, matrix.rows_count / seconds,
+      TraversalKernelName(kernel));
+    if (early_exit) {
+      logger.Info("Early exit: %.2lf of %lu trees per sample on average (confidence %g)",
+        TreesPerSample(matrix.rows_count), trees.size(), early_exit_confidence);
     }
   }
 
+  // 打分 rows_count 个样本后平均每个样本遍历的树数
+  double TreesPerSample(long long rows_count) const {
+    return rows_count > 0 ? double(trees_scored) / rows_count : 0.0;
+  }
+
   // 0 for no threading, neg number for using all the cpus, pos number for specifying a certain number
   int threading = 0;
   int tree_count = 100;
   int features_count;
   int one_sample_size = 1000;
   DecisionTreeInfo decision_tree_info = DecisionTreeInfo();
-  const std::vector<Sample> &samples;
+  const FeatureMatrix &matrix;
+  // 相同的种子 (及参数) 总是得到相同的森林，默认每次运行随机取一个
+  uint64_t seed = std::random_device()();
+  // 为 true 时每棵树有放回地采样
+  bool bootstrap = false;
+  // 训练时用 out-of-bag 样本估计准确率；importance 时同时计算置换重要性并写入 importance_file
+  bool oob = false;
+  bool importance = false;
+  std::string importance_file = "importance.csv";
+  std::vector<std::pair<int, int>> oob_votes;
+  std::vector<std::vector<double>> tree_importance;
+  std::mutex oob_mutex;
+  // 按 decision_tree_info.criterion 实例化的 DecisionTree::BuildTree，构造时选定
+  BuildTreeFunc build_tree;
+  // 大于 0 时训练中每新增这么多棵树写一次 checkpoint_file
+  int checkpoint_every = 0;
+  std::string checkpoint_file = "tree.bin";
+  // 置为 true 后 CalcTrees 不再开始新的树，等正在建的树完成后返回 (可在信号处理函数中设置)
+  std::atomic<bool> stop_requested{false};
+  // 打分时只需要硬标签：结果确定后不再让剩下的树投票 (见 VoteDecided)。
+  // early_exit_confidence 在 (0, 1) 时按统计界提前停止，结果可能与完整投票不同
+  bool early_exit = false;
+  double early_exit_confidence = 0.0;
+  mutable std::atomic<long long> trees_scored{0};
+  // 打分时遍历树使用的内核，默认按 CPU 自动选择
+  TraversalKernel kernel = DetectTraversalKernel();
 
   std::vector<std::pair<int, int>> decision_res;
 
   std::vector<DecisionTree> trees;
+  // 见 PrepareMatrixColumns，只在 CalcTrees 期间不为空
+  SparseColumns matrix_columns;
+  // 保证 mmap 加载的树所指向的内存有效
+  std::vector<std::shared_ptr<MappedFile>> model_files;
   Logger logger;
-  std::mutex trees_mutex, decision_res_mutex;
 };
 
 #endif
@@ -0,0 +1,193 @@
+#ifndef SIMD_TRAVERSAL_H
+#define SIMD_TRAVERSAL_H
+
+#include <immintrin.h>
+#include <string>
+#include <algorithm>
+#include "decision-tree.h"
+#include "feature-matrix.h"
+
+// 多个样本同步地走同一棵树：每一步用 gather 取出各样本所在结点的阈值、特征和孩子，
+// 再 gather 对应的特征值并比较。AVX2 每批 8 个样本 (2 x 4 路 double)，
+// AVX-512 每批 16 个 (2 x 8 路)，两路交替执行以掩盖 gather 的延迟。
+// 比较使用 _CMP_LT_OQ，与 TestTree 中 !(x < v) 走右侧一致 (NaN 走右侧)，结果逐位相同。
+// 只处理稠密的 FeatureMatrix；函数按 target 属性单独编译，运行时按 CPU 选择
+enum class TraversalKernel { kScalar, kAvx2, kAvx512 };
+
+inline const char *TraversalKernelName(TraversalKernel kernel) {
+  switch (kernel) {
+    case TraversalKernel::kAvx2: return "avx2";
+    case TraversalKernel::kAvx512: return "avx512";
+    default: return "scalar";
+  }
+}
+
+inline bool TraversalKernelSupported(TraversalKernel kernel) {
+  switch (kernel) {
+    case TraversalKernel::kAvx2:
+      return __builtin_cpu_supports("avx2");
+    case TraversalKernel::kAvx512:
+      return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl");
+    default:
+      return true;
+  }
+}
+
+inline TraversalKernel DetectTraversalKernel() {
+  if (TraversalKernelSupported(TraversalKernel::kAvx512)) return TraversalKernel::kAvx512;
+  if (TraversalKernelSupported(TraversalKernel::kAvx2)) return TraversalKernel::kAvx2;
+  return TraversalKernel::kScalar;
+}
+
+// "scalar"/"avx2"/"avx512"，未知或当前 CPU 不支持时退回自动检测的结果
+inline TraversalKernel ParseTraversalKernel(const std::string &name) {
+  TraversalKernel kernel = DetectTraversalKernel();
+  if (name == "scalar") kernel = TraversalKernel::kScalar;
+  else if (name == "avx2") kernel = TraversalKernel::kAvx2;
+  else if (name == "avx512") kernel = TraversalKernel::kAvx512;
+  return TraversalKernelSupported(kernel) ? kernel : DetectTraversalKernel();
+}
+
+// TreeNode 按 int 看: [0, 1] 为 feature_val, [2] 为 feature_index, [3] 为 child
+static_assert(sizeof(DecisionTree::TreeNode) == 16, "SIMD traversal assumes a 16-byte TreeNode");
+
+inline void TraverseScalar(const DecisionTree::TreeNode *nodes, const LabelType *leaf_labels,
+  const FeatureMatrix &matrix, int begin, int end, LabelType *out) {
+  for (int i = begin; i < end; ++i) {
+    int visiting = 0;
+    while (nodes[visiting].feature_index != DecisionTree::kLeaf) {
+      auto &node = nodes[visiting];
+      visiting = node.child + !(matrix.Get(i, node.feature_index) < node.feature_val);
+    }
+    out[i - begin] = leaf_labels[nodes[visiting].child];
+  }
+}
+
+struct Avx2Lanes {
+  __m128i node;
+  __m256i row;
+};
+
+// 前进一步，返回 4 路是否都已到达叶子
+__attribute__((target("avx2")))
+inline bool StepAvx2(Avx2Lanes &lanes, const int *node_ints, const double *node_doubles,
+  const double *values, __m256i rows_count) {
+  const __m128i leaf = _mm_set1_epi32(DecisionTree::kLeaf);
+  __m128i node4 = _mm_slli_epi32(lanes.node, 2);
+  __m128i feature = _mm_i32gather_epi32(node_ints + 2, node4, 4);
+  __m128i is_leaf = _mm_cmpeq_epi32(feature, leaf);
+  if (_mm_movemask_ps(_mm_castsi128_ps(is_leaf)) == 0xF) return true;
+  __m128i child = _mm_i32gather_epi32(node_ints + 3, node4, 4);
+  __m256d threshold = _mm256_i32gather_pd(node_doubles, _mm_slli_epi32(lanes.node, 1), 8);
+  // 叶子所在的路读第 0 列，结果会被丢弃
+  __m128i safe_feature = _mm_max_epi32(feature, _mm_setzero_si128());
+  __m256i offset = _mm256_add_epi64(
+    _mm256_mul_epu32(_mm256_cvtepi32_epi64(safe_feature), rows_count), lanes.row);
+  __m256d x = _mm256_i64gather_pd(values, offset, 8);
+  __m256i lt = _mm256_castpd_si256(_mm256_cmp_pd(x, threshold, _CMP_LT_OQ));
+  // 每个 64 位掩码取低 32 位
+  __m128i lt32 = _mm256_castsi256_si128(
+    _mm256_permutevar8x32_epi32(lt, _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0)));
+  // < 阈值时 lt32 为 -1，走 child；否则走 child + 1
+  __m128i next = _mm_add_epi32(_mm_add_epi32(child, _mm_set1_epi32(1)), lt32);
+  lanes.node = _mm_blendv_epi8(next, lanes.node, is_leaf);
+  return false;
+}
+
+__attribute__((target("avx2")))
+inline void TraverseAvx2(const DecisionTree::TreeNode *nodes, const LabelType *leaf_labels,
+  const FeatureMatrix &matrix, int begin, int end, LabelType *out) {
+  auto node_ints = reinterpret_cast<const int*>(nodes);
+  auto node_doubles = reinterpret_cast<const double*>(nodes);
+  auto values = matrix.Values();
+  __m256i rows_count = _mm256_set1_epi64x(matrix.rows_count);
+  int i = begin;
+  for (; i + 8 <= end; i += 8) {
+    Avx2Lanes a = { _mm_setzero_si128(), _mm256_setr_epi64x(i, i + 1, i + 2, i + 3) };
+    Avx2Lanes b = { _mm_setzero_si128(), _mm256_setr_epi64x(i + 4, i + 5, i + 6, i + 7) };
+    bool a_done = false, b_done = false;
+    while (!(a_done && b_done)) {
+      if (!a_done) a_done = StepAvx2(a, node_ints, node_doubles, values, rows_count);
+      if (!b_done) b_done = StepAvx2(b, node_ints, node_doubles, values, rows_count);
+    }
+    alignas(16) int leaves[8];
+    _mm_store_si128(reinterpret_cast<__m128i*>(leaves), a.node);
+    _mm_store_si128(reinterpret_cast<__m128i*>(leaves + 4), b.node);
+    for (int k = 0; k < 8; ++k) out[i - begin + k] = leaf_labels[nodes[leaves[k]].child];
+  }
+  TraverseScalar(nodes, leaf_labels, matrix, i, end, out + (i - begin));
+}
+
+struct Avx512Lanes {
+  __m256i node;
+  __m512i row;
+};
+
+__attribute__((target("avx512f,avx512vl")))
+inline bool StepAvx512(Avx512Lanes &lanes, const int *node_ints, const double *node_doubles,
+  const double *values, __m512i rows_count) {
+  const __m256i leaf = _mm256_set1_epi32(DecisionTree::kLeaf);
+  __m256i node4 = _mm256_slli_epi32(lanes.node, 2);
+  __m256i feature = _mm256_i32gather_epi32(node_ints + 2, node4, 4);
+  __mmask8 active = _mm256_cmpneq_epi32_mask(feature, leaf);
+  if (active == 0) return true;
+  __m256i child = _mm256_i32gather_epi32(node_ints + 3, node4, 4);
+  __m512d threshold = _mm512_i32gather_pd(_mm256_slli_epi32(lanes.node, 1), node_doubles, 8);
+  __m256i safe_feature = _mm256_max_epi32(feature, _mm256_setzero_si256());
+  __m512i offset = _mm512_add_epi64(
+    _mm512_mul_epu32(_mm512_cvtepi32_epi64(safe_feature), rows_count), lanes.row);
+  __m512d x = _mm512_i64gather_pd(offset, values, 8);
+  __mmask8 lt = _mm512_cmp_pd_mask(x, threshold, _CMP_LT_OQ);
+  __m256i right = _mm256_add_epi32(child, _mm256_set1_epi32(1));
+  __m256i next = _mm256_mask_blend_epi32(lt, right, child);
+  lanes.node = _mm256_mask_blend_epi32(active, lanes.node, next);
+  return false;
+}
+
+__attribute__((target("avx512f,avx512vl")))
+inline void TraverseAvx512(const DecisionTree::TreeNode *nodes, const LabelType *leaf_labels,
+  const FeatureMatrix &matrix, int begin, int end, LabelType *out) {
+  auto node_ints = reinterpret_cast<const int*>(nodes);
+  auto node_doubles = reinterpret_cast<const double*>(nodes);
+  auto values = matrix.Values();
+  __m512i rows_count = _mm512_set1_epi64(matrix.rows_count);
+  __m512i lane_offsets = _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+  int i = begin;
+  for (; i + 16 <= end; i += 16) {
+    Avx512Lanes a = { _mm256_setzero_si256(),
+      _mm512_add_epi64(_mm512_set1_epi64(i), lane_offsets) };
+    Avx512Lanes b = { _mm256_setzero_si256(),
+      _mm512_add_epi64(_mm512_set1_epi64(i + 8), lane_offsets) };
+    bool a_done = false, b_done = false;
+    while (!(a_done && b_done)) {
+      if (!a_done) a_done = StepAvx512(a, node_ints, node_doubles, values, rows_count);
+      if (!b_done) b_done = StepAvx512(b, node_ints, node_doubles, values, rows_count);
+    }
+    alignas(32) int leaves[16];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(leaves), a.node);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(leaves + 8), b.node);
+    for (int k = 0; k < 16; ++k) out[i - begin + k] = leaf_labels[nodes[leaves[k]].child];
+  }
+  TraverseAvx2(nodes, leaf_labels, matrix, i, end, out + (i - begin));
+}
+
+// 把 matrix 中 [begin, end) 的样本在一棵树上的结果写入 out[0, end - begin)
+inline void TraverseTree(TraversalKernel kernel, const DecisionTree &tree,
+  const FeatureMatrix &matrix, int begin, int end, LabelType *out) {
+  if (tree.NodesCount() == 0) {
+    std::fill(out, out + (end - begin), LabelType(-2));
+    return;
+  }
+  switch (kernel) {
+    case TraversalKernel::kAvx512:
+      TraverseAvx512(tree.Nodes(), tree.LeafLabels(), matrix, begin, end, out);
+      break;
+    case TraversalKernel::kAvx2:
+      TraverseAvx2(tree.Nodes(), tree.LeafLabels(), matrix, begin, end, out);
+      break;
+    default:
+      TraverseScalar(tree.Nodes(), tree.LeafLabels(), matrix, begin, end, out);
+  }
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef SPARSE_COLUMNS_H
+#define SPARSE_COLUMNS_H
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include "feature-matrix.h"
+#include "thread-pool.h"
+
+// 一棵树的样本在各特征上的非 0 值，按列存放 (CSC)，供 exact 模式的分裂搜索使用。
+// 样本用它在建树样本中的位置 (slot) 标识，bootstrap 重复抽到的样本各占一个 slot。
+// 每列按值升序排列，负数在前，0 不出现在列中：结点中某特征为 0 的样本数由结点的
+// 样本总数减去非 0 的个数得到，因此扫描一列的代价只与非 0 的个数有关
+struct SparseColumns {
+  struct Entry {
+    FeatureVal val;
+    int slot;
+    LabelType label;
+  };
+
+  std::vector<std::vector<Entry>> columns;
+  // columns[f] 中第一个正数的位置
+  std::vector<int> positive_begins;
+  // 覆盖的 slot 数，列中只出现这些 slot
+  int slots_count = 0;
+
+  // 第 s 个 slot 为 matrix 中的第 rows[s] 行，代价为
+  // O(rows.size() * features_count) 次读取加上对非 0 值的排序
+  static SparseColumns Build(const FeatureMatrix &matrix, const RowIndexVec &rows,
+    ThreadPool *pool, int parallel_cutoff) {
+    SparseColumns res;
+    res.slots_count = rows.size();
+    res.columns.resize(matrix.features_count);
+    res.positive_begins.resize(matrix.features_count);
+    auto build_columns = [&matrix, &rows, &res](int first, int last) {
+      auto labels = matrix.Labels();
+      for (int f = first; f < last; ++f) {
+        auto column = matrix.Column(f);
+        auto &entries = res.columns[f];
+        for (int s = 0; s < rows.size(); ++s) {
+          auto val = column[rows[s]];
+          if (val != 0.0) entries.push_back({ val, s, labels[rows[s]] });
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry &lhs, const Entry &rhs) {
+          return lhs.val < rhs.val;
+        });
+        res.SetPositiveBegin(f);
+      }
+    };
+    res.ForEachColumn(pool && rows.size() >= parallel_cutoff ? pool : nullptr, build_columns);
+    return res;
+  }
+
+  // 整个矩阵的 SparseColumns，第 s 个 slot 就是第 s 行。多棵树共用，见 Select
+  static SparseColumns FromMatrix(const FeatureMatrix &matrix, ThreadPool *pool,
+    int parallel_cutoff) {
+    RowIndexVec rows(matrix.rows_count);
+    std::iota(rows.begin(), rows.end(), 0);
+    return Build(matrix, rows, pool, parallel_cutoff);
+  }
+
+  // 在 FromMatrix 的结果上取出 rows 对应的项，第 s 个 slot 为第 rows[s] 行，与 Build
+  // 的结果相同 (相同的值之间顺序可能不同)。列已经有序，不需要再排序，代价为
+  // O(NonZerosCount() + rows.size())，样本数接近非 0 值的个数时比 Build 快得多
+  SparseColumns Select(const RowIndexVec &rows, ThreadPool *pool, int parallel_cutoff) const {
+    // 同一行可能被 bootstrap 抽到多次，用链表记下它的所有 slot
+    std::vector<int> first_slot(slots_count, -1), next_slot(rows.size());
+    for (int s = rows.size() - 1; s >= 0; --s) {
+      next_slot[s] = first_slot[rows[s]];
+      first_slot[rows[s]] = s;
+    }
+    SparseColumns res;
+    res.slots_count = rows.size();
+    res.columns.resize(columns.size());
+    res.positive_begins.resize(columns.size());
+    auto select_columns = [this, &first_slot, &next_slot, &res](int first, int last) {
+      for (int f = first; f < last; ++f) {
+        auto &entries = res.columns[f];
+        for (auto &entry : columns[f]) {
+          for (int s = first_slot[entry.slot]; s >= 0; s = next_slot[s]) {
+            entries.push_back({ entry.val, s, entry.label });
+          }
+        }
+        res.SetPositiveBegin(f);
+      }
+    };
+    ForEachColumn(pool && rows.size() >= parallel_cutoff ? pool : nullptr, select_columns);
+    return res;
+  }
+
+  size_t NonZerosCount() const {
+    size_t count = 0;
+    for (auto &entries : columns) count += entries.size();
+    return count;
+  }
+
+  // 只保留 keep(slot) 为真的项，保持各列的顺序。keep 为真的 slot 应恰好有 slots_count 个
+  template <typename Keep>
+  SparseColumns Filter(Keep keep, int slots_count, ThreadPool *pool,
+    int parallel_cutoff) const {
+    SparseColumns res;
+    res.slots_count = slots_count;
+    res.columns.resize(columns.size());
+    res.positive_begins.resize(columns.size());
+    auto filter_columns = [this, &keep, &res](int first, int last) {
+      for (int f = first; f < last; ++f) {
+        auto &entries = res.columns[f];
+        for (auto &entry : columns[f]) {
+          if (keep(entry.slot)) entries.push_back(entry);
+        }
+        res.SetPositiveBegin(f);
+      }
+    };
+    // 各列的长度大致与覆盖的 slot 数成正比
+    ForEachColumn(pool && this->slots_count >= parallel_cutoff ? pool : nullptr,
+      filter_columns);
+    return res;
+  }
+
+ private:
+  void SetPositiveBegin(int f) {
+    auto &entries = columns[f];
+    positive_begins[f] = std::partition_point(entries.begin(), entries.end(),
+      [](const Entry &entry) { return entry.val < 0.0; }) - entries.begin();
+  }
+
+  template <typename F>
+  void ForEachColumn(ThreadPool *pool, F &&func) const {
+    if (pool) {
+      pool->ParallelFor(0, columns.size(), 0, func);
+    } else {
+      func(0, columns.size());
+    }
+  }
+};
+
+#endif
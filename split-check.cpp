@@ -0,0 +1,152 @@
+// 用 `make split-check` 构建并运行：
+//   split-check.out [-cases 20000] [-seed 1]
+// 在随机生成的小矩阵上比较 DecisionTree::GetBestSplit 与逐个阈值暴力计算的结果，
+// 分别检查对结点排序后搜索和在 SparseColumns 上搜索两条路径。
+// 特征值取自一个很小的集合 (含负数、0 和 -0.0)，使结点中出现大量相同的值；
+// 样本可以重复 (bootstrap)，结点只占 indexes 的一段。有任何不一致时返回非 0
+#include "decision-tree.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// 对结点中每个不同的值 v 尝试 value < v 的分裂，按值升序取第一个最小值
+template <typename Criterion>
+DecisionTree::BestSplitRes BruteForceSplit(const FeatureMatrix &matrix, const RowIndexVec &rows,
+  const std::vector<int> &features) {
+  int total_count = rows.size(), total_0_count = 0;
+  for (auto row : rows) total_0_count += matrix.Label(row) == 0;
+  DecisionTree::BestSplitRes res;
+  double min_gini = DecisionTree::kNoSplit;
+  for (auto f : features) {
+    std::vector<FeatureVal> vals;
+    for (auto row : rows) vals.push_back(matrix.Get(row, f));
+    std::sort(vals.begin(), vals.end());
+    vals.erase(std::unique(vals.begin(), vals.end()), vals.end());
+    for (auto v : vals) {
+      int left_count = 0, left_0_count = 0;
+      for (auto row : rows) {
+        if (matrix.Get(row, f) < v) {
+          ++left_count;
+          left_0_count += matrix.Label(row) == 0;
+        }
+      }
+      if (left_count == 0) continue;
+      auto gini = Criterion::Score(left_0_count, left_count, total_0_count - left_0_count,
+        total_count - left_count);
+      if (gini < min_gini) {
+        min_gini = gini;
+        res.feature_index = f;
+        res.feature_val = v;
+      }
+    }
+  }
+  return res;
+}
+
+struct SplitCase {
+  FeatureMatrix matrix;
+  RowIndexVec indexes;
+  int begin = 0, end = 0;
+  std::vector<int> features;
+};
+
+SplitCase RandomCase(Randomer &randomer) {
+  constexpr FeatureVal kValues[] = { -2.5, -1.0, -0.5, -0.0, 0.0, 0.0, 0.0, 0.5, 1.0, 3.0 };
+  constexpr int kValuesCount = sizeof(kValues) / sizeof(kValues[0]);
+  SplitCase c;
+  int rows_count = randomer.RandInt(1, 40);
+  int features_count = randomer.RandInt(1, 6);
+  c.matrix = FeatureMatrix(rows_count, features_count);
+  for (int f = 0; f < features_count; ++f) {
+    // 每个特征的稀疏程度不同，有的全为 0，有的没有 0
+    double zero_rate = randomer.RandDouble();
+    bool continuous = randomer.RandInt(0, 4) == 0;
+    auto column = c.matrix.MutableColumn(f);
+    for (int row = 0; row < rows_count; ++row) {
+      if (randomer.RandDouble() < zero_rate) continue;
+      column[row] = continuous ? randomer.RandDouble() * 4.0 - 2.0
+                               : kValues[randomer.RandInt(0, kValuesCount)];
+    }
+  }
+  double label_0_rate = randomer.RandDouble();
+  for (int row = 0; row < rows_count; ++row) {
+    c.matrix.labels[row] = randomer.RandDouble() < label_0_rate ? 0 : 1;
+  }
+  int size = randomer.RandInt(1, 48);
+  c.indexes = randomer.RandInt(0, 2) ? randomer.Sample(rows_count, std::min(size, rows_count))
+                                     : randomer.SampleWithReplacement(rows_count, size);
+  size = c.indexes.size();
+  c.begin = randomer.RandInt(0, size);
+  c.end = randomer.RandInt(c.begin + 1, size + 1);
+  c.features = randomer.Sample(features_count, randomer.RandInt(1, features_count + 1));
+  return c;
+}
+
+// sparse 为真时在 SparseColumns 上搜索，否则对结点排序后搜索
+template <typename Criterion>
+int CheckCase(const char *name, int case_index, const SplitCase &c, ThreadPool *pool,
+  bool sparse) {
+  RowIndexVec rows(c.indexes.begin() + c.begin, c.indexes.begin() + c.end);
+  auto expected = BruteForceSplit<Criterion>(c.matrix, rows, c.features);
+  DecisionTree tree;
+  tree.matrix = &c.matrix;
+  tree.indexes = c.indexes;
+  // 有线程池时每个结点都走按特征并行的分支
+  tree.pool = pool;
+  tree.parallel_cutoff = 1;
+  SparseColumns matrix_columns, columns;
+  if (sparse) {
+    // 一半的用例从整个矩阵的列中选出样本 (SparseColumns::Select)
+    if (case_index % 2) {
+      matrix_columns = SparseColumns::FromMatrix(c.matrix, nullptr, 0);
+      tree.matrix_columns = &matrix_columns;
+    }
+    // 列中还有结点以外的 slot，它们属于结点前后的两个区间
+    columns = tree.BuildSparseColumns();
+    tree.LabelSlots(c.begin, c.end);
+    tree.LabelSlots(c.end, c.indexes.size());
+  }
+  auto res = tree.GetBestSplit<Criterion>(c.begin, c.end, c.features,
+    sparse ? &columns : nullptr);
+  if (res.feature_index == expected.feature_index && res.feature_val == expected.feature_val) {
+    return 0;
+  }
+  printf("case %d (%s, %s%s): %d rows in node, got feature %d < %g, "
+    "expected feature %d < %g\n", case_index, name, sparse ? "sparse" : "sorted",
+    pool ? ", parallel" : "", c.end - c.begin, res.feature_index, res.feature_val,
+    expected.feature_index, expected.feature_val);
+  return 1;
+}
+
+int Run(int argc, char *args[]) {
+  ArgsTable table = ParseArgs(argc, args, 1);
+  int cases = 20000;
+  int seed = 1;
+  TableValToInt(table, "-cases", cases);
+  TableValToInt(table, "-seed", seed);
+
+  ThreadPool pool(2);
+  Randomer randomer(seed);
+  int mismatch_count = 0;
+  for (int i = 0; i < cases && mismatch_count < 10; ++i) {
+    auto c = RandomCase(randomer);
+    ThreadPool *case_pool = i % 8 == 0 ? &pool : nullptr;
+    for (bool sparse : { false, true }) {
+      mismatch_count += CheckCase<GiniCriterion>("gini", i, c, case_pool, sparse);
+      mismatch_count += CheckCase<EntropyCriterion>("entropy", i, c, case_pool, sparse);
+      mismatch_count += CheckCase<MisclassificationCriterion>("misclass", i, c, case_pool,
+        sparse);
+    }
+  }
+  if (mismatch_count > 0) {
+    printf("GetBestSplit differs from the brute-force scan\n");
+    return 1;
+  }
+  printf("All %d cases match\n", cases);
+  return 0;
+}
+
+int main(int argc, char *args[]) {
+  return RunMain(argc, args, Run);
+}
@@ -0,0 +1,66 @@
+#ifndef SPLIT_CRITERION_H
+#define SPLIT_CRITERION_H
+
+#include <cmath>
+#include <string>
+#include <algorithm>
+
+// 分裂准则。作为 DecisionTree 建树函数的模板参数在编译期选定，候选分裂的打分可以完全内联；
+// 具体使用哪一个由 RandomForest 构造时决定一次。
+// Score 只依赖左右两侧的 (标签 0 的计数, 样本数)，两侧都不为空，越小越好
+enum class SplitCriterion { kGini, kEntropy, kMisclassification };
+
+struct GiniCriterion {
+  // 两侧 Gini 不纯度直接相加，不按样本数加权，与之前训练出的模型保持一致
+  static double Score(int left_0_count, int left_count, int right_0_count, int right_count) {
+    return Impurity(left_0_count, left_count) + Impurity(right_0_count, right_count);
+  }
+
+  static double Impurity(int label_0_count, int count) {
+    auto p1 = label_0_count / double(count);
+    auto p2 = (count - label_0_count) / double(count);
+    return (p1 * (1.0 - p1)) + (p2 * (1.0 - p2));
+  }
+};
+
+// 按样本数加权的两侧熵之和，父结点的熵是常数，最小化它即最大化信息增益
+struct EntropyCriterion {
+  static double Score(int left_0_count, int left_count, int right_0_count, int right_count) {
+    return WeightedEntropy(left_0_count, left_count) + WeightedEntropy(right_0_count, right_count);
+  }
+
+  // count * H，以 nat 为单位
+  static double WeightedEntropy(int label_0_count, int count) {
+    return -(Term(label_0_count, count) + Term(count - label_0_count, count));
+  }
+
+  static double Term(int k, int count) {
+    return k > 0 ? k * std::log(double(k) / count) : 0.0;
+  }
+};
+
+// 两侧各取多数标签时分错的样本数
+struct MisclassificationCriterion {
+  static double Score(int left_0_count, int left_count, int right_0_count, int right_count) {
+    return std::min(left_0_count, left_count - left_0_count)
+         + std::min(right_0_count, right_count - right_0_count);
+  }
+};
+
+inline const char *SplitCriterionName(SplitCriterion criterion) {
+  switch (criterion) {
+    case SplitCriterion::kEntropy: return "entropy";
+    case SplitCriterion::kMisclassification: return "misclass";
+    default: return "gini";
+  }
+}
+
+// gini|entropy|misclass
+inline SplitCriterion ParseSplitCriterion(const std::string &name) {
+  if (name == "gini") return SplitCriterion::kGini;
+  if (name == "entropy") return SplitCriterion::kEntropy;
+  if (name == "misclass") return SplitCriterion::kMisclassification;
+  throw std::string("Unknown split criterion: ") + name;
+}
+
+#endif
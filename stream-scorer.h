@@ -0,0 +1,155 @@
+#ifndef STREAM_SCORER_H
+#define STREAM_SCORER_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <exception>
+#include "random-forest.h"
+#include "data-reader.h"
+#include "thread-pool.h"
+
+// 内存有界的流式打分：读取并解析一块 -> 在线程池上打分 -> 经缓冲写出，三个阶段由
+// 容量为 kQueueCapacity 的队列连接，各自在独立线程中运行，因此可以互相重叠。
+// 同时存在的块最多约 2 * kQueueCapacity + 3 个，内存与输入大小无关
+struct StreamScorer {
+  constexpr static size_t kQueueCapacity = 2;
+
+  struct ScoreChunk {
+    long long first_id = 0;
+    CsrMatrix rows;
+    std::vector<std::pair<int, int>> votes;
+  };
+  using ChunkPtr = std::unique_ptr<ScoreChunk>;
+
+  StreamScorer(const RandomForest &forest, ThreadPool &pool, size_t chunk_size,
+    const Logger &logger = Logger())
+    : forest(forest), pool(pool), chunk_size(chunk_size), logger(logger) {}
+
+  // 读取 in 中的 libsvm 行，按 SaveTest 的格式写到 out，返回打分的样本数
+  long long Run(FILE *in, FILE *out) {
+    BoundedQueue<ChunkPtr> parsed(kQueueCapacity), scored(kQueueCapacity);
+    std::exception_ptr read_error, write_error;
+    auto start = high_clock::now();
+
+    std::thread reader([this, in, &parsed, &read_error]() {
+      try {
+        ReadChunks(in, parsed);
+      } catch (...) {
+        read_error = std::current_exception();
+      }
+      parsed.Close();
+    });
+    std::thread writer([this, out, &scored, &parsed, &write_error]() {
+      try {
+        WriteChunks(out, scored);
+      } catch (...) {
+        write_error = std::current_exception();
+        // 下游失败时让上游尽快停下
+        parsed.Close();
+        scored.Close();
+      }
+    });
+
+    long long rows_count = 0;
+    ChunkPtr chunk;
+    while (parsed.Pop(chunk)) {
+      ScoreChunk &c = *chunk;
+      c.votes.assign(c.rows.rows_count, { 0, 0 });
+      {
+        PROFILE_SCOPE("ScoreChunk");
+        pool.ParallelFor(0, c.rows.rows_count, RandomForest::kTestBlockSize,
+          [this, &c](int begin, int end) {
+            // 每个块先展开成小的稠密矩阵，树的遍历不必在 CSR 的行内二分查找
+            auto block = FeatureMatrix::FromCsr(c.rows, begin, end, forest.features_count);
+            forest.VoteRows(block, 0, end - begin, c.votes.data() + begin);
+          });
+      }
+      rows_count += c.rows.rows_count;
+      if (!scored.Push(std::move(chunk))) break;
+    }
+    scored.Close();
+    reader.join();
+    writer.join();
+    if (read_error) std::rethrow_exception(read_error);
+    if (write_error) std::rethrow_exception(write_error);
+
+    double seconds = duration_cast<duration<double>>(high_clock::now() - start).count();
+    logger.Info("Scored %lld samples in %lf s (%.0lf samples/s)", rows_count, seconds,
+      rows_count / seconds);
+    if (forest.early_exit) {
+      logger.Info("Early exit: %.2lf of %lu trees per sample on average",
+        forest.TreesPerSample(rows_count), forest.trees.size());
+    }
+    return rows_count;
+  }
+
+ private:
+  // 每次读入 chunk_size 字节，末尾不完整的一行留给下一块
+  void ReadChunks(FILE *in, BoundedQueue<ChunkPtr> &parsed) {
+    std::vector<char> buffer;
+    size_t carry = 0;
+    long long next_id = 0;
+    while (true) {
+      buffer.resize(carry + chunk_size);
+      size_t read_size = fread(buffer.data() + carry, 1, chunk_size, in);
+      PROFILE_COUNT(kBytesRead, read_size);
+      size_t size = carry + read_size;
+      bool eof = read_size < chunk_size;
+      if (size == 0) break;
+      size_t parse_size = size;
+      if (!eof) {
+        auto last_newline = static_cast<const char*>(memrchr(buffer.data(), '\n', size));
+        // 一整块都没有换行时继续读，直到凑齐一行
+        if (!last_newline) {
+          carry = size;
+          continue;
+        }
+        parse_size = last_newline - buffer.data() + 1;
+      }
+      ChunkPtr chunk(new ScoreChunk());
+      chunk->first_id = next_id;
+      {
+        PROFILE_SCOPE("ParseChunk");
+        LibsvmParser::ParseCsr(buffer.data(), buffer.data() + parse_size,
+          forest.features_count, chunk->rows);
+      }
+      next_id += chunk->rows.rows_count;
+      carry = size - parse_size;
+      memmove(buffer.data(), buffer.data() + parse_size, carry);
+      if (chunk->rows.rows_count > 0 && !parsed.Push(std::move(chunk))) break;
+      if (eof) break;
+    }
+    if (ferror(in)) {
+      throw std::string("Something wrong in reading input");
+    }
+  }
+
+  void WriteChunks(FILE *out, BoundedQueue<ChunkPtr> &scored) {
+    std::string buffer = "id,label\n";
+    char line[64];
+    ChunkPtr chunk;
+    while (scored.Pop(chunk)) {
+      for (int i = 0; i < chunk->votes.size(); ++i) {
+        auto &res = chunk->votes[i];
+        double rate = double(res.first) / (res.first + res.second);
+        int n = snprintf(line, sizeof(line), "%lld,%g\n", chunk->first_id + i, rate);
+        buffer.append(line, n);
+      }
+      if (fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size()) {
+        throw std::string("Something wrong in writing output");
+      }
+      buffer.clear();
+    }
+    fflush(out);
+  }
+
+  const RandomForest &forest;
+  ThreadPool &pool;
+  size_t chunk_size;
+  Logger logger;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef SYNTHETIC_DATA_H
+#define SYNTHETIC_DATA_H
+
+#include <cstdio>
+#include <string>
+#include <algorithm>
+#include "util.h"
+
+// 生成 libsvm 格式的合成数据集，用于基准测试。特征下标为 [1, features_count)：
+// 前 kInformativeCount 个特征每行都出现，标签由它们 (减去均值后) 的线性组合加噪声的
+// 符号决定，两类各占约一半；其余特征各以 density 的概率出现。
+// 相同的参数与种子总是生成相同的文件
+struct SyntheticData {
+  constexpr static int kInformativeCount = 4;
+  // 离散特征取 [1, 6) 中的整数，均值为 3
+  constexpr static double kDiscreteMean = 3.0;
+
+  // 标签为 1 的比例在这个范围内时认为两类平衡
+  constexpr static double kMinOnesRate = 0.4, kMaxOnesRate = 0.6;
+
+  static bool Balanced(int ones_count, int rows_count) {
+    double rate = rows_count > 0 ? double(ones_count) / rows_count : 0.5;
+    return rate >= kMinOnesRate && rate <= kMaxOnesRate;
+  }
+
+  // 返回标签为 1 的行数
+  static int Write(const std::string &filename, int rows_count, int features_count,
+    double density, uint64_t seed) {
+    FILE *fd = fopen(filename.c_str(), "wb");
+    if (!fd) {
+      throw std::string("File not opened: ") + filename;
+    }
+    Randomer randomer(seed);
+    int informative_count = std::min(kInformativeCount, features_count - 1);
+    std::string buffer;
+    char item[48];
+    int ones_count = 0;
+    for (int row = 0; row < rows_count; ++row) {
+      std::string line;
+      double score = 0.0;
+      for (int f = 1; f < features_count; ++f) {
+        bool informative = f <= informative_count;
+        if (!informative && randomer.RandDouble() >= density) continue;
+        // 一部分特征取离散值，使排序时出现大量相同的值
+        double val = f % 3 ? randomer.RandDouble() * 6.0 - 3.0 : randomer.RandInt(1, 6);
+        if (informative) score += (f % 2 ? 1.0 : -0.5) * (f % 3 ? val : val - kDiscreteMean);
+        int n = snprintf(item, sizeof(item), " %d:%.4g", f, val);
+        line.append(item, n);
+      }
+      // 近似正态的噪声
+      double noise = 0.0;
+      for (int i = 0; i < 4; ++i) noise += randomer.RandDouble() - 0.5;
+      bool label = score + noise > 0;
+      ones_count += label;
+      buffer += label ? '1' : '0';
+      buffer += line;
+      buffer += '\n';
+      if (buffer.size() >= (1 << 20)) {
+        fwrite(buffer.data(), 1, buffer.size(), fd);
+        buffer.clear();
+      }
+    }
+    fwrite(buffer.data(), 1, buffer.size(), fd);
+    bool failed = ferror(fd);
+    fclose(fd);
+    if (failed) {
+      throw std::string("Something wrong in writing ") + filename;
+    }
+    return ones_count;
+  }
+};
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <thread>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <type_traits>
+#include <condition_variable>
+#include "profiler.h"
+
+// threading 为 -p 的取值：负数表示使用全部 CPU 核，否则为指定的线程数
+// (0 表示不并行，需要并行的地方仍用一个线程)。返回线程池的大小，至少为 1
+inline int ThreadCount(int threading) {
+  int count = threading < 0 ? int(std::thread::hardware_concurrency()) : threading;
+  return std::max(count, 1);
+}
+
+// 每个 worker 持有自己的双端队列：自己从尾部取 (LIFO)，空闲时从其他 worker 的头部偷取。
+// Submit 不会阻塞；析构时会先执行完所有已提交的任务再退出。
+class ThreadPool {
+ public:
+  using Job = std::function<void()>;
+
+  explicit ThreadPool(int size) : queues(size > 0 ? size : 1) {
+    for (int worker_index = 0; worker_index < queues.size(); ++worker_index) {
+      workers.push_back(std::thread([this, worker_index]() {
+        CurrentPool() = this;
+        CurrentIndex() = worker_index;
+        WorkerLoop(worker_index);
+      }));
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      stopping = true;
+    }
+    sleep_cv.notify_all();
+    for (auto &worker : workers) worker.join();
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool &operator=(const ThreadPool&) = delete;
+
+  int Size() const { return queues.size(); }
+
+  template <typename F>
+  auto Submit(F &&func) -> std::future<typename std::result_of<F()>::type> {
+    using ResType = typename std::result_of<F()>::type;
+    // std::function 要求可复制，因此 packaged_task 放在 shared_ptr 里
+    auto task = std::make_shared<std::packaged_task<ResType()>>(std::forward<F>(func));
+    auto future = task->get_future();
+    Push([task]() { (*task)(); });
+    return future;
+  }
+
+  // 把 [begin, end) 切成大小为 chunk_size 的块并行执行 func(chunk_begin, chunk_end)，
+  // 返回时所有块均已完成。chunk_size <= 0 时按每个 worker 约 4 块切分
+  void ParallelFor(int begin, int end, int chunk_size,
+    const std::function<void(int, int)> &func);
+
+  // 阻塞直到所有已提交的任务执行完毕，在 worker 中调用时会帮忙执行任务
+  void WaitAll() {
+    while (unfinished_count.load() > 0) {
+      if (RunPendingJob()) continue;
+      std::unique_lock<std::mutex> lock(done_mutex);
+      done_cv.wait_for(lock, std::chrono::microseconds(200), [this]() {
+        return unfinished_count.load() == 0;
+      });
+    }
+  }
+
+  // 取出一个排队中的任务并在当前线程执行，没有任务时返回 false
+  bool RunPendingJob() {
+    Job job;
+    int self = CurrentPool() == this ? CurrentIndex() : 0;
+    if (!TryPop(self, job)) return false;
+    RunJob(job);
+    return true;
+  }
+
+  void Push(Job job) {
+    unfinished_count.fetch_add(1);
+    int target = CurrentPool() == this
+      ? CurrentIndex()
+      : int(next_queue.fetch_add(1) % queues.size());
+    {
+      std::lock_guard<std::mutex> lock(queues[target].mutex);
+      queues[target].jobs.push_back(std::move(job));
+    }
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      ++queued_count;
+    }
+    sleep_cv.notify_one();
+  }
+
+ private:
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  bool TryPop(int self, Job &job) {
+    {
+      auto &own = queues[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.jobs.empty()) {
+        job = std::move(own.jobs.back());
+        own.jobs.pop_back();
+        TookOne();
+        return true;
+      }
+    }
+    for (int i = 1; i < queues.size(); ++i) {
+      auto &victim = queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.jobs.empty()) {
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        TookOne();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void TookOne() {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    --queued_count;
+  }
+
+  void RunJob(Job &job) {
+    {
+      PROFILE_DETACH();
+      job();
+    }
+    if (unfinished_count.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> lock(done_mutex);
+      done_cv.notify_all();
+    }
+  }
+
+  void WorkerLoop(int worker_index) {
+    while (true) {
+      Job job;
+      if (TryPop(worker_index, job)) {
+        RunJob(job);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex);
+      sleep_cv.wait(lock, [this]() { return stopping || queued_count > 0; });
+      // 停止时也要等队列清空才退出
+      if (stopping && queued_count == 0) return;
+    }
+  }
+
+  std::vector<WorkerQueue> queues;
+  std::vector<std::thread> workers;
+  std::atomic<unsigned> next_queue{0};
+  std::atomic<int> unfinished_count{0};
+
+  std::mutex sleep_mutex;
+  std::condition_variable sleep_cv;
+  int queued_count = 0;
+  bool stopping = false;
+
+  std::mutex done_mutex;
+  std::condition_variable done_cv;
+
+  // 当前线程所属的池及其 worker 下标，不是 worker 的线程为 nullptr
+  static ThreadPool *&CurrentPool() {
+    static thread_local ThreadPool *pool = nullptr;
+    return pool;
+  }
+  static int &CurrentIndex() {
+    static thread_local int index = 0;
+    return index;
+  }
+};
+
+// 一组任务的屏障：Wait 返回时组内任务都已完成，第一个异常会在 Wait 中重新抛出。
+// Wait 期间当前线程会帮忙执行池中的任务，因此可以在 worker 内嵌套使用
+class TaskGroup {
+ public:
+  explicit TaskGroup(ThreadPool &pool) : pool(pool) {}
+  ~TaskGroup() {
+    try {
+      Wait();
+    } catch (...) {}
+  }
+
+  void Run(std::function<void()> func) {
+    pending.fetch_add(1);
+    pool.Push([this, func]() {
+      try {
+        func();
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) error = std::current_exception();
+      }
+      // 持锁递减：Wait 在返回前会取一次锁，保证这里不会访问已析构的 TaskGroup
+      std::lock_guard<std::mutex> lock(mutex);
+      if (pending.fetch_sub(1) == 1) cv.notify_all();
+    });
+  }
+
+  void Wait() {
+    while (pending.load() > 0) {
+      if (pool.RunPendingJob()) continue;
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait_for(lock, std::chrono::microseconds(200), [this]() {
+        return pending.load() == 0;
+      });
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (error) {
+      auto e = error;
+      error = nullptr;
+      std::rethrow_exception(e);
+    }
+  }
+
+ private:
+  ThreadPool &pool;
+  std::atomic<int> pending{0};
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::exception_ptr error;
+};
+
+// 有界的阻塞队列，用于连接流水线的各个阶段。Close 之后 Push 失败，Pop 取完剩余元素后返回 false
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+  bool Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [this]() { return closed || items.size() < capacity; });
+    if (closed) return false;
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+    return true;
+  }
+
+  bool Pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+    if (items.empty()) return false;
+    item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  // 与 Pop 相同，但最多等到 deadline，超时也返回 false
+  template <typename Clock, typename Duration>
+  bool PopUntil(T &item, const std::chrono::time_point<Clock, Duration> &deadline) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait_until(lock, deadline, [this]() { return closed || !items.empty(); });
+    if (items.empty()) return false;
+    item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+
+ private:
+  size_t capacity;
+  std::deque<T> items;
+  bool closed = false;
+  std::mutex mutex;
+  std::condition_variable not_full, not_empty;
+};
+
+inline void ThreadPool::ParallelFor(int begin, int end, int chunk_size,
+  const std::function<void(int, int)> &func) {
+  if (begin >= end) return;
+  if (chunk_size <= 0) {
+    chunk_size = (end - begin + Size() * 4 - 1) / (Size() * 4);
+  }
+  TaskGroup group(*this);
+  for (int chunk_begin = begin; chunk_begin < end; chunk_begin += chunk_size) {
+    int chunk_end = std::min(end, chunk_begin + chunk_size);
+    group.Run([&func, chunk_begin, chunk_end]() { func(chunk_begin, chunk_end); });
+  }
+  group.Wait();
+}
+
+#endif
@@ -5,9 +5,17 @@
 #include <vector>
 #include <random>
 #include <cstdio>
+#include <cstdint>
+#include <cstddef>
 #include <cstdarg>
+#include <algorithm>
+#include <exception>
+#include <unordered_set>
+#include <unordered_map>
 
 #include <chrono>
+#include <memory>
+#include "async-log.h"
 
 inline void SplitString(std::vector<std::string>& res, const std::string &str,
   const std::string &delim) {
@@ -22,6 +30,60 @@ inline void SplitString(std::vector<std::string>& res, const std::string &str,
   res.push_back(str.substr(offset));
 }
 
+// 命令行中 "-key value" 形式的参数
+using ArgsTable = std::unordered_map<std::string, std::string>;
+
+// 从 args[first] 起按 "-key value" 成对读取
+inline ArgsTable ParseArgs(int argc, char *args[], int first) {
+  ArgsTable table;
+  for (int i = first; i + 1 < argc; i += 2) {
+    table[args[i]] = args[i + 1];
+  }
+  return table;
+}
+
+inline void TableValToInt(const ArgsTable &table, const std::string &key, int &val) {
+  if (table.count(key) > 0) {
+    sscanf(table.at(key).c_str(), "%d", &val);
+  }
+}
+
+inline void TableValToDouble(const ArgsTable &table, const std::string &key, double &val) {
+  if (table.count(key) > 0) {
+    sscanf(table.at(key).c_str(), "%lf", &val);
+  }
+}
+
+// 种子不能悄悄地退回随机值，不是数字时报错
+inline void TableValToUint64(const ArgsTable &table, const std::string &key, uint64_t &val) {
+  if (table.count(key) > 0) {
+    unsigned long long parsed;
+    if (sscanf(table.at(key).c_str(), "%llu", &parsed) != 1) {
+      throw std::string("Invalid value for ") + key + ": " + table.at(key);
+    }
+    val = parsed;
+  }
+}
+
+inline void TableValToString(const ArgsTable &table, const std::string &key, std::string &val) {
+  if (table.count(key) > 0) {
+    val = table.at(key);
+  }
+}
+
+// 各程序的 main 都交给它：run 中抛出的 std::string (输入数据或模型文件有误等)
+// 和 std::exception 输出到 stderr 并返回 1，而不是让进程 abort
+inline int RunMain(int argc, char *args[], int (*run)(int, char *[])) {
+  try {
+    return run(argc, args);
+  } catch (const std::string &e) {
+    fprintf(stderr, "%s\n", e.c_str());
+  } catch (const std::exception &e) {
+    fprintf(stderr, "%s\n", e.what());
+  }
+  return 1;
+}
+
 inline int pow(int a, int b) {
   int res = 1;
   for (int i = 0; i < b; ++i) res *= a;
@@ -35,29 +97,119 @@ inline std::vector<T> MergeVectors(const std::vector<T> &lhs, const std::vector<
   for (auto &i : rhs) vec.push_back(i);
 }
 
+constexpr uint64_t kFnvOffset = 14695981039346656037ull;
+constexpr uint64_t kFnvPrime = 1099511628211ull;
+
+inline uint64_t Fnv1a(const void *data, size_t size, uint64_t hash = kFnvOffset) {
+  auto bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= kFnvPrime;
+  }
+  return hash;
+}
+
+inline size_t AlignUp(size_t offset, size_t align) {
+  return (offset + align - 1) / align * align;
+}
+
+// 基于计数器的随机数发生器：第 n 个数为 Mix(key + n * kGolden)，key 由种子和流编号混合而来
+// (即 SplitMix64)。不同的流互不相关，每棵树、每个结点都可以拥有自己的流，
+// 因此结果只取决于种子，与线程调度无关
 struct Randomer {
-  // [lower, upper)
-  static int RandInt(int lower, int upper) {
-    std::random_device rd;
-    return rd() % (upper - lower) + lower;
+  constexpr static uint64_t kGolden = 0x9e3779b97f4a7c15ull;
+
+  explicit Randomer(uint64_t seed = 0, uint64_t stream = 0)
+    : key(Mix(Mix(seed) + stream * kGolden)) {}
+
+  static uint64_t Mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  uint64_t Next() {
+    return Mix(key + kGolden * ++counter);
+  }
+
+  // [0, 1)
+  double RandDouble() {
+    return (Next() >> 11) * (1.0 / (1ull << 53));
+  }
+
+  // [lower, upper)，用乘法代替取模映射到区间，偏差不超过 (upper - lower) / 2^32
+  int RandInt(int lower, int upper) {
+    return lower + int(((Next() >> 32) * uint64_t(upper - lower)) >> 32);
+  }
+
+  // 从 [0, n) 中不放回地取 min(k, n) 个。k 远小于 n 时用 Floyd 算法 (O(k))，
+  // 否则用部分 Fisher–Yates (O(n))
+  std::vector<int> Sample(int n, int k) {
+    k = std::max(0, std::min(k, n));
+    std::vector<int> res;
+    res.reserve(k);
+    if (k * 16 <= n) {
+      std::unordered_set<int> chosen(k * 2);
+      for (int j = n - k; j < n; ++j) {
+        int t = RandInt(0, j + 1);
+        if (!chosen.insert(t).second) {
+          chosen.insert(j);
+          t = j;
+        }
+        res.push_back(t);
+      }
+      return res;
+    }
+    std::vector<int> pool(n);
+    for (int i = 0; i < n; ++i) pool[i] = i;
+    for (int i = 0; i < k; ++i) {
+      std::swap(pool[i], pool[RandInt(i, n)]);
+      res.push_back(pool[i]);
+    }
+    return res;
+  }
+
+  // 从 [0, n) 中有放回地取 k 个 (bootstrap)
+  std::vector<int> SampleWithReplacement(int n, int k) {
+    std::vector<int> res(n > 0 ? k : 0);
+    for (auto &i : res) i = RandInt(0, n);
+    return res;
   }
+
+  uint64_t key;
+  uint64_t counter = 0;
 };
 
+enum class LogLevel { kDebug, kInfo, kOff };
+
+// 编译时低于该级别的日志直接去掉，例如 -DRF_LOG_MIN_LEVEL=1 去掉所有 Debug
+#ifndef RF_LOG_MIN_LEVEL
+#define RF_LOG_MIN_LEVEL 0
+#endif
+
+// 日志先在调用线程中格式化，再交给 AsyncLog 的后台线程输出，调用方不会在 stdio 的锁上等待。
+// 低于 min_level 的日志在格式化之前就返回。Logger 可以随意复制，各副本共用同一个文件
 struct Logger {
+  bool Enabled(LogLevel level) const {
+    return int(level) >= RF_LOG_MIN_LEVEL && level >= min_level && (to_screen || file);
+  }
+
   void VLog(const char *tag, const char *format, va_list vl) {
-    if (to_screen) {
-      printf("[%s]\t", tag);
-      vprintf(format, vl);
-      printf("\n");
-    }
-    if (to_file) {
-      fprintf(fd, "[%s]\t", tag);
-      vfprintf(fd, format, vl);
-      fprintf(fd, "\n");
-    }
+    AsyncLog::Instance().Push(to_screen, file.get(), [tag, format, &vl](char *text, size_t size) {
+      // 只格式化一次，屏幕和文件共用结果
+      va_list args;
+      va_copy(args, vl);
+      int n = snprintf(text, size, "[%s]\t", tag);
+      n += std::max(0, vsnprintf(text + n, size - n, format, args));
+      va_end(args);
+      n = std::min<int>(n, size - 1);
+      text[n++] = '\n';
+      return n;
+    });
   }
 
   void Debug(const char *format, ...) {
+    if (!Enabled(LogLevel::kDebug)) return;
     va_list args;
     va_start(args, format);
     VLog("Debug", format, args);
@@ -65,39 +217,41 @@ struct Logger {
   }
 
   void Info(const char *format, ...) {
+    if (!Enabled(LogLevel::kInfo)) return;
     va_list args;
     va_start(args, format);
     VLog("Info", format, args);
     va_end(args);
   }
 
-  Logger(bool to_screen = true, bool to_file = false, const std::string &filename = "")
-    : to_screen(to_screen), to_file(to_file), filename(filename) {
-    fd = fopen(filename.c_str(), "a");
+  // 阻塞到之前的日志都已写出，超时返回 false
+  static bool Flush(std::chrono::milliseconds timeout = std::chrono::milliseconds::max()) {
+    return AsyncLog::Instance().Flush(timeout);
+  }
+
+  Logger(bool to_screen = true, bool to_file = false, const std::string &filename = "",
+    LogLevel min_level = LogLevel::kDebug)
+    : to_screen(to_screen), to_file(to_file && !filename.empty()), filename(filename),
+      min_level(min_level) {
+    if (this->to_file) {
+      // 最后一个副本析构时先写完队列中的日志再关闭文件
+      file.reset(fopen(filename.c_str(), "a"), [](FILE *fd) {
+        if (!fd) return;
+        AsyncLog::Instance().Flush();
+        fclose(fd);
+      });
+    }
   }
 
   bool to_screen;
   bool to_file;
   const std::string filename;
+  LogLevel min_level;
  private:
-  FILE *fd;
+  std::shared_ptr<FILE> file;
 };
 
 using namespace std::chrono;
 using high_clock = high_resolution_clock;
-class TikTok {
-  high_clock::time_point t;
-  std::string tag;
- public:
-  void Tik() {
-    t = high_clock::now();
-  }
-  void Tok() {
-    auto dur = high_clock::now() - t;
-    printf("[-%s-] %lf\n", tag.c_str(),
-      float(std::chrono::duration_cast<milliseconds>(dur).count()) / 1000.0);
-  }
-  TikTok(const std::string &tag) : tag(tag) {}
-};
 
 #endif